@@ -0,0 +1,665 @@
+/*
+ * bench.c - Application interfacing module for traffic generation and
+ *           measurement
+ *
+ * Copyright (C) 2013-2017, Microchip Technology Germany II GmbH & Co. KG
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This file is licensed under GPLv2.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/sort.h>
+#include "mostcore.h"
+
+#define BENCH_MAGIC		0x4d424e43	/* "MBNC" */
+#define NUM_LAT_SAMPLES		4096
+
+/**
+ * struct bench_hdr - header put at the start of every generated packet
+ * @magic: identifies a packet generated by this AIM
+ * @seq: sequence number of the packet
+ * @ts: time of submission in nanoseconds
+ */
+struct bench_hdr {
+	u32 magic;
+	u32 seq;
+	u64 ts;
+};
+
+/**
+ * struct bench_channel - linked channel
+ * @kobj: "bench" directory below the sysfs directory of the channel
+ * @list: position in the channel list
+ * @iface: interface the channel belongs to
+ * @channel_id: channel index
+ * @cfg: channel configuration
+ * @run_mutex: serializes start and stop of the measurement
+ * @is_running: measurement is active
+ * @task: traffic generator of TX channels
+ * @wq: waitq of the traffic generator
+ * @ts_fifo: submission times of the TX MBOs owned by the HDM
+ * @packet_size: size of a generated packet, 0 means buffer size
+ * @burst: number of packets generated back-to-back
+ * @rate: packets per second, 0 means as fast as possible
+ * @tx_len: length of the generated packets of the running measurement
+ * @stats_lock: protects the counters below
+ * @bytes: transferred bytes
+ * @pkts: transferred packets
+ * @starved: number of times no MBO was available to the generator
+ * @lost: number of packets missing in the received sequence
+ * @seq: next sequence number to send or expected to be received
+ * @start_time: time the measurement was started
+ * @stop_time: time the measurement was stopped
+ * @lat: ring of turnaround latency samples in nanoseconds
+ * @lat_pos: next position in lat
+ * @lat_count: number of valid samples in lat
+ */
+struct bench_channel {
+	struct kobject kobj;
+	struct list_head list;
+	struct most_interface *iface;
+	int channel_id;
+	struct most_channel_config *cfg;
+	struct mutex run_mutex;
+	bool is_running;
+	struct task_struct *task;
+	wait_queue_head_t wq;
+	DECLARE_KFIFO_PTR(ts_fifo, u64);
+	u32 packet_size;
+	u32 burst;
+	u32 rate;
+	u32 tx_len;
+	spinlock_t stats_lock; /* sync counter access */
+	u64 bytes;
+	u64 pkts;
+	u64 starved;
+	u64 lost;
+	u32 seq;
+	ktime_t start_time;
+	ktime_t stop_time;
+	u32 lat[NUM_LAT_SAMPLES];
+	unsigned int lat_pos;
+	unsigned int lat_count;
+};
+
+#define to_bench_channel(k) container_of(k, struct bench_channel, kobj)
+
+static struct most_aim bench_aim;
+static struct list_head channel_list = LIST_HEAD_INIT(channel_list);
+static DEFINE_SPINLOCK(ch_list_lock);
+
+static struct bench_channel *get_channel(struct most_interface *iface, int id)
+{
+	struct bench_channel *c;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ch_list_lock, flags);
+	list_for_each_entry(c, &channel_list, list) {
+		if (c->iface == iface && c->channel_id == id) {
+			spin_unlock_irqrestore(&ch_list_lock, flags);
+			return c;
+		}
+	}
+	spin_unlock_irqrestore(&ch_list_lock, flags);
+	return NULL;
+}
+
+static inline bool ch_has_mbo(struct bench_channel *c)
+{
+	return channel_has_mbo(c->iface, c->channel_id, &bench_aim) > 0;
+}
+
+/**
+ * add_sample - account a transferred packet
+ * @c: channel
+ * @len: number of bytes
+ * @lat_ns: turnaround latency or a negative value if unknown
+ */
+static void add_sample(struct bench_channel *c, unsigned int len, s64 lat_ns)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&c->stats_lock, flags);
+	c->bytes += len;
+	c->pkts++;
+	if (lat_ns >= 0) {
+		c->lat[c->lat_pos] = min_t(s64, lat_ns, U32_MAX);
+		c->lat_pos = (c->lat_pos + 1) % NUM_LAT_SAMPLES;
+		if (c->lat_count < NUM_LAT_SAMPLES)
+			c->lat_count++;
+	}
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+}
+
+static void reset_stats(struct bench_channel *c)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&c->stats_lock, flags);
+	c->bytes = 0;
+	c->pkts = 0;
+	c->starved = 0;
+	c->lost = 0;
+	c->seq = 0;
+	c->lat_pos = 0;
+	c->lat_count = 0;
+	c->start_time = ktime_get();
+	c->stop_time = c->start_time;
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+}
+
+/**
+ * generator_thread - TX traffic generator
+ * @data: channel
+ *
+ * Submits bursts of packets and paces them according to the configured
+ * rate. Every packet carries a bench_hdr if it is big enough.
+ */
+static int generator_thread(void *data)
+{
+	struct bench_channel *c = data;
+	u32 burst = c->burst ? c->burst : 1;
+	u32 rate = c->rate;
+	struct bench_hdr *hdr;
+	struct mbo *mbo;
+	ktime_t next = ktime_get();
+	u32 sent;
+	u64 now;
+
+	while (!kthread_should_stop()) {
+		sent = 0;
+		while (sent < burst && !kthread_should_stop()) {
+			mbo = most_get_mbo(c->iface, c->channel_id,
+					   &bench_aim);
+			if (!mbo) {
+				spin_lock_irq(&c->stats_lock);
+				c->starved++;
+				spin_unlock_irq(&c->stats_lock);
+				wait_event_interruptible(c->wq,
+							 ch_has_mbo(c) ||
+							 kthread_should_stop());
+				continue;
+			}
+
+			now = ktime_get_ns();
+			if (c->tx_len >= sizeof(*hdr)) {
+				hdr = mbo->virt_address;
+				hdr->magic = BENCH_MAGIC;
+				hdr->seq = c->seq++;
+				hdr->ts = now;
+			}
+			mbo->buffer_length = min(c->tx_len,
+						 mbo->buffer_length);
+			kfifo_put(&c->ts_fifo, now);
+			most_submit_mbo(mbo);
+			sent++;
+		}
+
+		if (!rate) {
+			cond_resched();
+			continue;
+		}
+
+		next = ktime_add_ns(next, div_u64((u64)burst * NSEC_PER_SEC,
+						  rate));
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+	}
+	return 0;
+}
+
+static int start_bench(struct bench_channel *c)
+{
+	int ret;
+
+	ret = kfifo_alloc(&c->ts_fifo, c->cfg->num_buffers, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	ret = most_start_channel(c->iface, c->channel_id, &bench_aim);
+	if (ret)
+		goto free_fifo;
+
+	reset_stats(c);
+	c->tx_len = c->packet_size;
+	if (!c->tx_len || c->tx_len > c->cfg->buffer_size)
+		c->tx_len = c->cfg->buffer_size;
+	c->is_running = true;
+	if (c->cfg->direction != MOST_CH_TX)
+		return 0;
+
+	c->task = kthread_run(generator_thread, c, "most_bench");
+	if (IS_ERR(c->task)) {
+		ret = PTR_ERR(c->task);
+		c->task = NULL;
+		c->is_running = false;
+		most_stop_channel(c->iface, c->channel_id, &bench_aim);
+		goto free_fifo;
+	}
+	return 0;
+
+free_fifo:
+	kfifo_free(&c->ts_fifo);
+	return ret;
+}
+
+static void stop_bench(struct bench_channel *c)
+{
+	unsigned long flags;
+
+	if (c->task) {
+		kthread_stop(c->task);
+		c->task = NULL;
+	}
+	spin_lock_irqsave(&c->stats_lock, flags);
+	c->is_running = false;
+	c->stop_time = ktime_get();
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+	most_stop_channel(c->iface, c->channel_id, &bench_aim);
+	kfifo_free(&c->ts_fifo);
+}
+
+/*		     ___	 ___
+ *		     ___S Y S F S___
+ */
+
+struct bench_attr {
+	struct attribute attr;
+	ssize_t (*show)(struct bench_channel *c, char *buf);
+	ssize_t (*store)(struct bench_channel *c, const char *buf,
+			 size_t count);
+};
+
+#define to_bench_attr(a) container_of(a, struct bench_attr, attr)
+
+static ssize_t run_show(struct bench_channel *c, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", c->is_running);
+}
+
+static ssize_t run_store(struct bench_channel *c, const char *buf,
+			 size_t count)
+{
+	bool run;
+	int ret = kstrtobool(buf, &run);
+
+	if (ret)
+		return ret;
+
+	mutex_lock(&c->run_mutex);
+	if (run && !c->is_running)
+		ret = start_bench(c);
+	else if (!run && c->is_running)
+		stop_bench(c);
+	mutex_unlock(&c->run_mutex);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t packet_size_show(struct bench_channel *c, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->packet_size);
+}
+
+static ssize_t packet_size_store(struct bench_channel *c, const char *buf,
+				 size_t count)
+{
+	int ret = kstrtou32(buf, 0, &c->packet_size);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t burst_show(struct bench_channel *c, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->burst);
+}
+
+static ssize_t burst_store(struct bench_channel *c, const char *buf,
+			   size_t count)
+{
+	int ret = kstrtou32(buf, 0, &c->burst);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t rate_show(struct bench_channel *c, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->rate);
+}
+
+static ssize_t rate_store(struct bench_channel *c, const char *buf,
+			  size_t count)
+{
+	int ret = kstrtou32(buf, 0, &c->rate);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t throughput_show(struct bench_channel *c, char *buf)
+{
+	unsigned long flags;
+	u64 bytes, pkts, elapsed_us;
+
+	spin_lock_irqsave(&c->stats_lock, flags);
+	bytes = c->bytes;
+	pkts = c->pkts;
+	elapsed_us = ktime_us_delta(c->is_running ? ktime_get() : c->stop_time,
+				    c->start_time);
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+
+	if (!elapsed_us)
+		return snprintf(buf, PAGE_SIZE, "0 0\n");
+
+	return snprintf(buf, PAGE_SIZE, "%llu %llu\n",
+			div64_u64(bytes * USEC_PER_SEC, elapsed_us),
+			div64_u64(pkts * USEC_PER_SEC, elapsed_us));
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static ssize_t latency_show(struct bench_channel *c, char *buf)
+{
+	static const unsigned int permille[] = { 500, 900, 990, 999 };
+	unsigned long flags;
+	unsigned int i, n;
+	u32 *lat;
+	int offs;
+
+	lat = kmalloc_array(NUM_LAT_SAMPLES, sizeof(*lat), GFP_KERNEL);
+	if (!lat)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&c->stats_lock, flags);
+	n = c->lat_count;
+	memcpy(lat, c->lat, n * sizeof(*lat));
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+
+	if (!n) {
+		kfree(lat);
+		return snprintf(buf, PAGE_SIZE, "0 0 0 0 0 0\n");
+	}
+
+	sort(lat, n, sizeof(*lat), cmp_u32, NULL);
+	offs = snprintf(buf, PAGE_SIZE, "%u", lat[0]);
+	for (i = 0; i < ARRAY_SIZE(permille); i++)
+		offs += snprintf(buf + offs, PAGE_SIZE - offs, " %u",
+				 lat[(n - 1) * permille[i] / 1000]);
+	offs += snprintf(buf + offs, PAGE_SIZE - offs, " %u\n", lat[n - 1]);
+	kfree(lat);
+	return offs;
+}
+
+static ssize_t starved_show(struct bench_channel *c, char *buf)
+{
+	unsigned long flags;
+	u64 starved;
+
+	spin_lock_irqsave(&c->stats_lock, flags);
+	starved = c->starved;
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+	return snprintf(buf, PAGE_SIZE, "%llu\n", starved);
+}
+
+static ssize_t lost_show(struct bench_channel *c, char *buf)
+{
+	unsigned long flags;
+	u64 lost;
+
+	spin_lock_irqsave(&c->stats_lock, flags);
+	lost = c->lost;
+	spin_unlock_irqrestore(&c->stats_lock, flags);
+	return snprintf(buf, PAGE_SIZE, "%llu\n", lost);
+}
+
+static struct bench_attr bench_attrs[] = {
+	__ATTR_RW(run),
+	__ATTR_RW(packet_size),
+	__ATTR_RW(burst),
+	__ATTR_RW(rate),
+	__ATTR_RO(throughput),
+	__ATTR_RO(latency),
+	__ATTR_RO(starved),
+	__ATTR_RO(lost),
+};
+
+static struct attribute *bench_def_attrs[] = {
+	&bench_attrs[0].attr,
+	&bench_attrs[1].attr,
+	&bench_attrs[2].attr,
+	&bench_attrs[3].attr,
+	&bench_attrs[4].attr,
+	&bench_attrs[5].attr,
+	&bench_attrs[6].attr,
+	&bench_attrs[7].attr,
+	NULL,
+};
+
+static ssize_t bench_attr_show(struct kobject *kobj, struct attribute *attr,
+			       char *buf)
+{
+	struct bench_attr *xattr = to_bench_attr(attr);
+
+	if (!xattr->show)
+		return -EIO;
+
+	return xattr->show(to_bench_channel(kobj), buf);
+}
+
+static ssize_t bench_attr_store(struct kobject *kobj, struct attribute *attr,
+				const char *buf, size_t count)
+{
+	struct bench_attr *xattr = to_bench_attr(attr);
+
+	if (!xattr->store)
+		return -EIO;
+
+	return xattr->store(to_bench_channel(kobj), buf, count);
+}
+
+static const struct sysfs_ops bench_sysfs_ops = {
+	.show = bench_attr_show,
+	.store = bench_attr_store,
+};
+
+static void bench_kobj_release(struct kobject *kobj)
+{
+	kfree(to_bench_channel(kobj));
+}
+
+static struct kobj_type bench_ktype = {
+	.release = bench_kobj_release,
+	.sysfs_ops = &bench_sysfs_ops,
+	.default_attrs = bench_def_attrs,
+};
+
+/*		     ___     ___
+ *		     ___A I M___
+ */
+
+/**
+ * bench_probe - probe function of the driver module
+ * @iface: pointer to interface instance
+ * @channel_id: channel index/ID
+ * @cfg: pointer to actual channel configuration
+ * @parent: pointer to kobject of the channel
+ * @name: unused
+ *
+ * This creates the "bench" directory in the sysfs directory of the
+ * channel.
+ *
+ * Returns 0 on success or error code otherwise.
+ */
+static int bench_probe(struct most_interface *iface, int channel_id,
+		       struct most_channel_config *cfg,
+		       struct kobject *parent, char *name)
+{
+	struct bench_channel *c;
+	unsigned long flags;
+	int ret;
+
+	if (!iface || !cfg || !parent) {
+		pr_info("Probing AIM with bad arguments");
+		return -EINVAL;
+	}
+	if (get_channel(iface, channel_id))
+		return -EEXIST;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	c->iface = iface;
+	c->channel_id = channel_id;
+	c->cfg = cfg;
+	c->burst = 1;
+	mutex_init(&c->run_mutex);
+	spin_lock_init(&c->stats_lock);
+	init_waitqueue_head(&c->wq);
+
+	ret = kobject_init_and_add(&c->kobj, &bench_ktype, parent, "bench");
+	if (ret) {
+		kobject_put(&c->kobj);
+		return ret;
+	}
+
+	spin_lock_irqsave(&ch_list_lock, flags);
+	list_add_tail(&c->list, &channel_list);
+	spin_unlock_irqrestore(&ch_list_lock, flags);
+	return 0;
+}
+
+/**
+ * bench_disconnect_channel - disconnect a channel
+ * @iface: pointer to interface instance
+ * @channel_id: channel index
+ *
+ * This stops a running measurement and removes the sysfs directory.
+ */
+static int bench_disconnect_channel(struct most_interface *iface,
+				    int channel_id)
+{
+	struct bench_channel *c = get_channel(iface, channel_id);
+	unsigned long flags;
+
+	if (!c)
+		return -ENXIO;
+
+	mutex_lock(&c->run_mutex);
+	if (c->is_running)
+		stop_bench(c);
+	mutex_unlock(&c->run_mutex);
+
+	spin_lock_irqsave(&ch_list_lock, flags);
+	list_del(&c->list);
+	spin_unlock_irqrestore(&ch_list_lock, flags);
+	kobject_put(&c->kobj);
+	return 0;
+}
+
+/**
+ * bench_rx_completion - completion handler for rx channels
+ * @mbo: pointer to buffer object that has completed
+ *
+ * Accounts the received packet, measures its latency if it carries a
+ * bench_hdr and returns the buffer to the core immediately.
+ */
+static int bench_rx_completion(struct mbo *mbo)
+{
+	struct bench_channel *c = get_channel(mbo->ifp, mbo->hdm_channel_id);
+	struct bench_hdr *hdr = mbo->virt_address;
+	unsigned long flags;
+	s64 lat_ns = -1;
+
+	if (!c || !c->is_running)
+		return -ENODEV;
+
+	if (mbo->processed_length >= sizeof(*hdr) &&
+	    hdr->magic == BENCH_MAGIC) {
+		lat_ns = ktime_get_ns() - hdr->ts;
+		spin_lock_irqsave(&c->stats_lock, flags);
+		if (hdr->seq != c->seq)
+			c->lost += (u32)(hdr->seq - c->seq);
+		c->seq = hdr->seq + 1;
+		spin_unlock_irqrestore(&c->stats_lock, flags);
+	}
+
+	add_sample(c, mbo->processed_length, lat_ns);
+	most_put_mbo(mbo);
+	return 0;
+}
+
+/**
+ * bench_tx_completion - completion handler for tx channels
+ * @iface: pointer to interface instance
+ * @channel_id: channel index/ID
+ *
+ * The HDM completes buffers in the order they were submitted, so the oldest
+ * submission time belongs to the buffer that came back.
+ */
+static int bench_tx_completion(struct most_interface *iface, int channel_id)
+{
+	struct bench_channel *c = get_channel(iface, channel_id);
+	u64 ts;
+
+	if (!c)
+		return -ENXIO;
+
+	if (c->is_running && kfifo_get(&c->ts_fifo, &ts))
+		add_sample(c, c->tx_len, ktime_get_ns() - ts);
+	wake_up_interruptible(&c->wq);
+	return 0;
+}
+
+static struct most_aim bench_aim = {
+	.name = "bench",
+	.probe_channel = bench_probe,
+	.disconnect_channel = bench_disconnect_channel,
+	.rx_completion = bench_rx_completion,
+	.tx_completion = bench_tx_completion,
+};
+
+static int __init mod_init(void)
+{
+	pr_info("init()\n");
+	return most_register_aim(&bench_aim);
+}
+
+static void __exit mod_exit(void)
+{
+	pr_info("exit module\n");
+	most_deregister_aim(&bench_aim);
+}
+
+module_init(mod_init);
+module_exit(mod_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Traffic generator and measurement AIM for mostcore");
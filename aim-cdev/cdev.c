@@ -23,6 +23,7 @@
 #include <linux/uaccess.h>
 #include <linux/idr.h>
 #include "mostcore.h"
+#include "most_cdev.h"
 
 #define MINOR_COUNT (50)
 static dev_t aim_devno;
@@ -216,7 +217,7 @@ static ssize_t aim_write(struct file *filp, const char __user *buf,
 		goto unlock;
 	}
 
-	to_copy = min(count, c->cfg->buffer_size - c->mbo_offs);
+	to_copy = min(count, mbo->buffer_length - c->mbo_offs);
 	left = copy_from_user(mbo->virt_address + c->mbo_offs, buf, to_copy);
 	if (left == to_copy) {
 		ret = -EFAULT;
@@ -224,7 +225,7 @@ static ssize_t aim_write(struct file *filp, const char __user *buf,
 	}
 
 	c->mbo_offs += to_copy - left;
-	if (c->mbo_offs >= c->cfg->buffer_size ||
+	if (c->mbo_offs >= mbo->buffer_length ||
 	    c->cfg->data_type == MOST_CH_CONTROL ||
 	    c->cfg->data_type == MOST_CH_ASYNC) {
 		kfifo_skip(&c->fifo);
@@ -308,6 +309,47 @@ static unsigned int aim_poll(struct file *filp, poll_table *wait)
 	return mask;
 }
 
+/**
+ * aim_ioctl - implements the ioctl syscall of the device
+ * @filp: file pointer
+ * @cmd: command
+ * @arg: pointer to struct most_cdev_buf_info in user space
+ *
+ * MOST_CDEV_GET_BUF_INFO returns the sequence number and timestamp of the
+ * received buffer that is read next.
+ */
+static long aim_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct aim_channel *c = filp->private_data;
+	struct most_cdev_buf_info info = { 0 };
+	struct mbo *mbo;
+	long ret = 0;
+
+	if (cmd != MOST_CDEV_GET_BUF_INFO)
+		return -ENOTTY;
+	if (c->cfg->direction != MOST_CH_RX)
+		return -EINVAL;
+
+	mutex_lock(&c->io_mutex);
+	if (unlikely(!c->dev))
+		ret = -ENODEV;
+	else if (!kfifo_peek(&c->fifo, &mbo))
+		ret = -EAGAIN;
+	if (ret) {
+		mutex_unlock(&c->io_mutex);
+		return ret;
+	}
+	info.seq = mbo->seq;
+	info.length = mbo->processed_length;
+	info.offset = c->mbo_offs;
+	info.timestamp_ns = ktime_to_ns(mbo->hw_ts);
+	mutex_unlock(&c->io_mutex);
+
+	if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+		return -EFAULT;
+	return 0;
+}
+
 /**
  * Initialization of struct file_operations
  */
@@ -318,6 +360,8 @@ static const struct file_operations channel_fops = {
 	.open = aim_open,
 	.release = aim_close,
 	.poll = aim_poll,
+	.unlocked_ioctl = aim_ioctl,
+	.compat_ioctl = aim_ioctl,
 };
 
 /**
@@ -362,7 +406,8 @@ static int aim_disconnect_channel(struct most_interface *iface, int channel_id)
  * @mbo: pointer to buffer object that has completed
  *
  * This searches for the channel linked to this MBO and stores it in the local
- * fifo buffer.
+ * fifo buffer. If the fifo is full, the buffer is dropped, which leaves a gap
+ * in the sequence numbers seen by the reader.
  */
 static int aim_rx_completion(struct mbo *mbo)
 {
@@ -377,12 +422,14 @@ static int aim_rx_completion(struct mbo *mbo)
 		spin_unlock(&c->unlink);
 		return -ENODEV;
 	}
-	kfifo_in(&c->fifo, &mbo, 1);
-	spin_unlock(&c->unlink);
+	if (!kfifo_in(&c->fifo, &mbo, 1)) {
+		spin_unlock(&c->unlink);
 #ifdef DEBUG_MESG
-	if (kfifo_is_full(&c->fifo))
 		pr_info("WARN: Fifo is full\n");
 #endif
+		return -ENOMEM;
+	}
+	spin_unlock(&c->unlink);
 	wake_up_interruptible(&c->wq);
 	return 0;
 }
@@ -0,0 +1,36 @@
+/*
+ * most_cdev.h - Interface of the character device AIM
+ *
+ * Copyright (C) 2013-2017, Microchip Technology Germany II GmbH & Co. KG
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This file is licensed under GPLv2.
+ */
+
+#ifndef __MOST_CDEV_H__
+#define __MOST_CDEV_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Describes the received buffer the next read() returns data of. The
+ * sequence numbers of the buffers of a channel are consecutive, so a gap
+ * tells that buffers were lost on the way.
+ */
+struct most_cdev_buf_info {
+	__u32 seq;
+	__u32 length; /* bytes of the buffer */
+	__u32 offset; /* bytes already read */
+	__u32 reserved;
+	__s64 timestamp_ns; /* CLOCK_MONOTONIC, completion in hardware */
+};
+
+/* define IOCTL command */
+#define MOST_CDEV_GET_BUF_INFO	_IOR('M', 0xa0, struct most_cdev_buf_info)
+
+#endif /* __MOST_CDEV_H__ */
@@ -320,14 +320,14 @@ static ssize_t aim_write(struct file *filp, const char __user *buf,
 		ret = -EUSERS;
 		goto unlock;
 	}
-	to_copy = min(count, c->most->cfg->buffer_size - c->mbo_offs);
+	to_copy = min(count, mbo->buffer_length - c->mbo_offs);
 	left = copy_from_user(mbo->virt_address + c->mbo_offs, buf, to_copy);
 	if (left == to_copy) {
 		ret = -EFAULT;
 		goto unlock;
 	}
 	c->mbo_offs += to_copy - left;
-	if (c->mbo_offs >= c->most->cfg->buffer_size ||
+	if (c->mbo_offs >= mbo->buffer_length ||
 	    c->most->cfg->data_type == MOST_CH_CONTROL ||
 	    c->most->cfg->data_type == MOST_CH_ASYNC) {
 		unsigned long flags;
@@ -1071,6 +1071,7 @@ static struct most_aim aim = {
 	.disconnect_channel = aim_disconnect_channel,
 	.rx_completion = aim_rx_completion,
 	.tx_completion = aim_tx_completion,
+	.queues_rx_mbo = true,
 };
 
 static int sysfstouint(const char *buf, size_t count, uint *val)
@@ -43,6 +43,9 @@ static struct most_aim audio_aim;
  * @opened: set when the stream is opened
  * @playback_task: playback thread
  * @playback_waitq: waitq used by playback thread
+ * @ts_lock: protects the link timestamp
+ * @link_ts: completion time of the last captured buffer
+ * @link_frames: frames captured until @link_ts
  */
 struct channel {
 	struct snd_pcm_substream *substream;
@@ -59,6 +62,10 @@ struct channel {
 	struct task_struct *playback_task;
 	wait_queue_head_t playback_waitq;
 
+	spinlock_t ts_lock;
+	ktime_t link_ts;
+	u64 link_frames;
+
 	void (*copy_fn)(void *alsa, void *most, unsigned int bytes);
 };
 
@@ -175,13 +182,19 @@ static bool copy_data(struct channel *channel, struct mbo *mbo)
 	struct snd_pcm_runtime *const runtime = channel->substream->runtime;
 	unsigned int const frame_bytes = channel->cfg->subbuffer_size;
 	unsigned int const buffer_size = runtime->buffer_size;
+	unsigned long flags;
 	unsigned int frames;
 	unsigned int fr0;
 
-	if (channel->cfg->direction & MOST_CH_RX)
+	if (channel->cfg->direction & MOST_CH_RX) {
 		frames = mbo->processed_length / frame_bytes;
-	else
+		spin_lock_irqsave(&channel->ts_lock, flags);
+		channel->link_ts = mbo->hw_ts;
+		channel->link_frames += frames;
+		spin_unlock_irqrestore(&channel->ts_lock, flags);
+	} else {
 		frames = mbo->buffer_length / frame_bytes;
+	}
 	fr0 = min(buffer_size - channel->buffer_pos, frames);
 
 	channel->copy_fn(runtime->dma_area + channel->buffer_pos * frame_bytes,
@@ -271,6 +284,8 @@ static int pcm_open(struct snd_pcm_substream *substream)
 			pr_err("Couldn't start thread\n");
 			return PTR_ERR(channel->playback_task);
 		}
+		most_sched_thread(channel->iface, channel->id,
+				  channel->playback_task);
 	}
 
 	if (most_start_channel(channel->iface, channel->id, &audio_aim)) {
@@ -290,7 +305,8 @@ static int pcm_open(struct snd_pcm_substream *substream)
  *
  * Obviously, this is called when a PCM substream is closed. Any private
  * instance for a PCM substream allocated in the open callback will be
- * released here.
+ * released here. The channel is stopped asynchronously, so that closing
+ * does not wait for the HDM to return its buffers.
  *
  * Returns 0 on success or error code otherwise.
  */
@@ -300,7 +316,8 @@ static int pcm_close(struct snd_pcm_substream *substream)
 
 	if (channel->cfg->direction == MOST_CH_TX)
 		kthread_stop(channel->playback_task);
-	most_stop_channel(channel->iface, channel->id, &audio_aim);
+	most_stop_channel_async(channel->iface, channel->id, &audio_aim,
+				NULL, NULL);
 
 	return 0;
 }
@@ -390,6 +407,10 @@ static int pcm_prepare(struct snd_pcm_substream *substream)
 
 	channel->period_pos = 0;
 	channel->buffer_pos = 0;
+	spin_lock_irq(&channel->ts_lock);
+	channel->link_ts = ktime_set(0, 0);
+	channel->link_frames = 0;
+	spin_unlock_irq(&channel->ts_lock);
 
 	return 0;
 }
@@ -440,6 +461,53 @@ static snd_pcm_uframes_t pcm_pointer(struct snd_pcm_substream *substream)
 	return channel->buffer_pos;
 }
 
+/**
+ * pcm_get_time_info - implements get_time_info callback for PCM middle layer
+ * @substream: substream pointer
+ * @system_ts: returns the system time of @audio_ts
+ * @audio_ts: returns the audio time
+ * @config: timestamp requested by the application
+ * @report: returns the timestamp actually provided
+ *
+ * For capture, the link timestamp pairs the frames received so far with the
+ * time the HDM completed the last buffer, so that applications can measure
+ * the drift between the MOST network clock and the system clock. Everything
+ * else is left to the default timestamps of the PCM middle layer.
+ */
+static int pcm_get_time_info(struct snd_pcm_substream *substream,
+			     struct timespec *system_ts,
+			     struct timespec *audio_ts,
+			     struct snd_pcm_audio_tstamp_config *config,
+			     struct snd_pcm_audio_tstamp_report *report)
+{
+	struct channel *channel = substream->private_data;
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	unsigned long flags;
+	ktime_t link_ts;
+	u64 frames;
+	u32 rem;
+
+	report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+	if (channel->cfg->direction != MOST_CH_RX ||
+	    config->type_requested != SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK ||
+	    runtime->tstamp_type != SNDRV_PCM_TSTAMP_TYPE_MONOTONIC)
+		return 0;
+
+	spin_lock_irqsave(&channel->ts_lock, flags);
+	link_ts = channel->link_ts;
+	frames = channel->link_frames;
+	spin_unlock_irqrestore(&channel->ts_lock, flags);
+	if (!ktime_to_ns(link_ts))
+		return 0;
+
+	*system_ts = ktime_to_timespec(link_ts);
+	audio_ts->tv_sec = div_u64_rem(frames, runtime->rate, &rem);
+	audio_ts->tv_nsec = div_u64((u64)rem * NSEC_PER_SEC, runtime->rate);
+	report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK;
+	report->accuracy_report = 0;
+	return 0;
+}
+
 /**
  * Initialization of struct snd_pcm_ops
  */
@@ -452,6 +520,7 @@ static const struct snd_pcm_ops pcm_ops = {
 	.prepare    = pcm_prepare,
 	.trigger    = pcm_trigger,
 	.pointer    = pcm_pointer,
+	.get_time_info = pcm_get_time_info,
 	.page       = snd_pcm_lib_get_vmalloc_page,
 	.mmap       = snd_pcm_lib_mmap_vmalloc,
 };
@@ -473,6 +542,8 @@ static int audio_set_hw_params(struct snd_pcm_hardware *pcm_hw,
 {
 	const struct channel *channel = container_of(pcm_hw, struct channel, pcm_hardware);
 	pcm_hw->info = MOST_PCM_INFO;
+	if (cfg->direction == MOST_CH_RX)
+		pcm_hw->info |= SNDRV_PCM_INFO_HAS_LINK_ATIME;
 	pcm_hw->rates = SNDRV_PCM_RATE_48000;
 	pcm_hw->rate_min = 48000;
 	pcm_hw->rate_max = 48000;
@@ -621,6 +692,7 @@ static int audio_probe_channel(struct most_interface *iface, int channel_id,
 	channel->iface = iface;
 	channel->id = channel_id;
 	init_waitqueue_head(&channel->playback_waitq);
+	spin_lock_init(&channel->ts_lock);
 
 	ret = audio_set_hw_params(&channel->pcm_hardware, pcm_format, cfg);
 	if (ret)
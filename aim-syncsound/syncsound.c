@@ -418,6 +418,7 @@ static int pcm_prepare_play(struct snd_pcm_substream *substream)
 		pr_debug("kthread_run: %d\n", err);
 		return -ENOMEM;
 	}
+	most_sched_thread(most->iface, most->channel_id, channel->playback_task);
 	err = most_start_channel(most->iface, most->channel_id, &aim);
 	if (err) {
 		pr_debug("most_start_channel failed: %d\n", err);
@@ -41,6 +41,9 @@ struct most_video_dev {
 
 	struct list_head pending_mbos;
 	spinlock_t list_lock;
+	bool seq_valid; /* next_seq is known */
+	u32 next_seq;
+	unsigned long lost_mbos;
 
 	struct v4l2_device v4l2_dev;
 	atomic_t access_ref;
@@ -104,6 +107,9 @@ static int aim_vdev_open(struct file *filp)
 
 	v4l2_fh_add(&fh->fh);
 
+	spin_lock_irq(&mdev->list_lock);
+	mdev->seq_valid = false;
+	spin_unlock_irq(&mdev->list_lock);
 	ret = most_start_channel(mdev->iface, mdev->ch_idx, &aim_info);
 	if (ret) {
 		v4l2_err(&mdev->v4l2_dev, "most_start_channel() failed\n");
@@ -431,6 +437,21 @@ static int aim_rx_data(struct mbo *mbo)
 		return -EIO;
 	}
 
+	/*
+	 * The stream is delivered by read(), hence a gap in the sequence
+	 * numbers can only be reported here. A step backwards is taken as
+	 * a new start.
+	 */
+	if (mdev->seq_valid && (s32)(mbo->seq - mdev->next_seq) > 0) {
+		mdev->lost_mbos += mbo->seq - mdev->next_seq;
+		pr_warn_ratelimited("%s: lost %u buffers (%lu total)\n",
+				    mdev->v4l2_dev.name,
+				    mbo->seq - mdev->next_seq,
+				    mdev->lost_mbos);
+	}
+	mdev->seq_valid = true;
+	mdev->next_seq = mbo->seq + 1;
+
 	list_add_tail(&mbo->list, &mdev->pending_mbos);
 	spin_unlock_irqrestore(&mdev->list_lock, flags);
 	wake_up_interruptible(&mdev->wait_data);
@@ -574,6 +595,7 @@ static struct most_aim aim_info = {
 	.probe_channel = aim_probe_channel,
 	.disconnect_channel = aim_disconnect_channel,
 	.rx_completion = aim_rx_data,
+	.queues_rx_mbo = true,
 };
 
 static int __init aim_init(void)
@@ -292,9 +292,16 @@ static struct most_config_set config_set[] = {
 static int __init mod_init(void)
 {
 	int i;
+	int err;
 
-	for (i = 0; i < ARRAY_SIZE(config_set); ++i)
-		most_register_config_set(config_set + i);
+	for (i = 0; i < ARRAY_SIZE(config_set); ++i) {
+		err = most_register_config_set(config_set + i);
+		if (err) {
+			while (--i >= 0)
+				most_deregister_config_set(config_set + i);
+			return err;
+		}
+	}
 	return 0;
 }
 
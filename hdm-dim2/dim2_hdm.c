@@ -106,6 +106,9 @@ struct dim2_hdm {
 	unsigned char link_state;
 	int atx_idx;
 	struct medialb_bus bus;
+	int ahb_irq;
+	int mlb_irq;
+	struct cpumask irq_affinity;
 };
 
 #define iface_to_hdm(iface) container_of(iface, struct dim2_hdm, most_iface)
@@ -218,57 +221,79 @@ static int startup_dim(struct platform_device *pdev)
 }
 
 /**
- * try_start_dim_transfer - try to transfer a buffer on a channel
+ * __try_start_dim_transfer - try to transfer a buffer on a channel
  * @hdm_ch: channel specific data
+ * @rejected: returns the buffer refused by the DIM
  *
- * Transfer a buffer from pending_list if the channel is ready
+ * Transfer a buffer from pending_list if the channel is ready.
+ * Must be called with dim_lock held. If the DIM refuses the buffer, it
+ * is removed from pending_list and -EFAULT is returned; the caller has to
+ * pass it to reject_mbo() after releasing dim_lock.
  */
-static int try_start_dim_transfer(struct hdm_channel *hdm_ch)
+static int __try_start_dim_transfer(struct hdm_channel *hdm_ch,
+				    struct mbo **rejected)
 {
 	u16 buf_size;
 	struct list_head *head = &hdm_ch->pending_list;
 	struct mbo *mbo;
-	unsigned long flags;
 	struct dim_ch_state_t st;
 
-	BUG_ON(!hdm_ch);
-	BUG_ON(!hdm_ch->is_initialized);
-
-	spin_lock_irqsave(&dim_lock, flags);
-	if (list_empty(head)) {
-		spin_unlock_irqrestore(&dim_lock, flags);
+	if (list_empty(head))
 		return -EAGAIN;
-	}
 
-	if (!dim_get_channel_state(&hdm_ch->ch, &st)->ready) {
-		spin_unlock_irqrestore(&dim_lock, flags);
+	if (!dim_get_channel_state(&hdm_ch->ch, &st)->ready)
 		return -EAGAIN;
-	}
 
 	mbo = list_first_entry(head, struct mbo, list);
 	buf_size = mbo->buffer_length;
 
-	if (dim_dbr_space(&hdm_ch->ch) < buf_size) {
-		spin_unlock_irqrestore(&dim_lock, flags);
+	if (dim_dbr_space(&hdm_ch->ch) < buf_size)
 		return -EAGAIN;
-	}
 
 	BUG_ON(mbo->bus_address == 0);
 	if (!dim_enqueue_buffer(&hdm_ch->ch, mbo->bus_address, buf_size)) {
 		list_del(head->next);
-		spin_unlock_irqrestore(&dim_lock, flags);
-		mbo->processed_length = 0;
-		mbo->status = MBO_E_INVAL;
-		mbo->complete(mbo);
+		*rejected = mbo;
 		return -EFAULT;
 	}
 
 	list_move_tail(head->next, &hdm_ch->started_list);
-	spin_unlock_irqrestore(&dim_lock, flags);
 
 	return 0;
 }
 
+static void reject_mbo(struct mbo *mbo)
+{
+	mbo->processed_length = 0;
+	mbo->status = MBO_E_INVAL;
+	mbo->complete(mbo);
+}
+
+/**
+ * try_start_dim_transfer - try to transfer a buffer on a channel
+ * @hdm_ch: channel specific data
+ *
+ * Transfer a buffer from pending_list if the channel is ready
+ */
+static int try_start_dim_transfer(struct hdm_channel *hdm_ch)
+{
+	struct mbo *mbo;
+	unsigned long flags;
+	int ret;
+
+	BUG_ON(!hdm_ch);
+	BUG_ON(!hdm_ch->is_initialized);
+
+	spin_lock_irqsave(&dim_lock, flags);
+	ret = __try_start_dim_transfer(hdm_ch, &mbo);
+	spin_unlock_irqrestore(&dim_lock, flags);
+
+	if (ret == -EFAULT)
+		reject_mbo(mbo);
+
+	return ret;
+}
+
 /**
  * deliver_netinfo_thread - thread to deliver network status to mostcore
  * @data: private data
@@ -329,6 +354,7 @@ static void service_done_flag(struct dim2_hdm *dev, int ch_idx)
 	struct mbo *mbo;
 	int done_buffers;
 	unsigned long flags;
+	ktime_t now = ktime_get();
 	u8 *data;
 
 	BUG_ON(!hdm_ch);
@@ -385,6 +411,7 @@ static void service_done_flag(struct dim2_hdm *dev, int ch_idx)
 				mbo->processed_length = mbo->buffer_length;
 			}
 			mbo->status = MBO_SUCCESS;
+			mbo->hw_ts = now;
 			mbo->complete(mbo);
 		}
 
@@ -528,6 +555,11 @@ static int configure_channel(struct most_interface *most_iface, int ch_idx,
 	if (hdm_ch->is_initialized)
 		return -EPERM;
 
+	if (ccfg->buffer_size > U16_MAX) {
+		pr_err("%s: too big buffer size\n", hdm_ch->name);
+		return -EINVAL;
+	}
+
 	switch (ccfg->data_type) {
 	case MOST_CH_CONTROL:
 		new_size = dim_norm_ctrl_async_buffer_size(buf_size);
@@ -645,6 +677,50 @@ static int enqueue(struct most_interface *most_iface, int ch_idx,
 	return 0;
 }
 
+/**
+ * enqueue_batch - enqueue a list of buffers for data transfer
+ * @iface: intended interface
+ * @channel: ID of the channel the buffers are intended for
+ * @mbos: list of buffer objects
+ *
+ * Move all buffers into pending_list and start as many transfers as the
+ * channel accepts, both with a single hold of dim_lock.
+ * Return 0 on success, negative on failure.
+ */
+static int enqueue_batch(struct most_interface *most_iface, int ch_idx,
+			 struct list_head *mbos)
+{
+	struct dim2_hdm *dev = iface_to_hdm(most_iface);
+	struct hdm_channel *hdm_ch = dev->hch + ch_idx;
+	struct mbo *mbo;
+	unsigned long flags;
+	int ret;
+
+	BUG_ON(ch_idx < 0 || ch_idx >= DMA_CHANNELS);
+
+	if (!hdm_ch->is_initialized)
+		return -EPERM;
+
+	list_for_each_entry(mbo, mbos, list)
+		if (mbo->bus_address == 0)
+			return -EFAULT;
+
+	spin_lock_irqsave(&dim_lock, flags);
+	list_splice_tail_init(mbos, &hdm_ch->pending_list);
+	do {
+		ret = __try_start_dim_transfer(hdm_ch, &mbo);
+	} while (!ret);
+	spin_unlock_irqrestore(&dim_lock, flags);
+
+	if (ret == -EFAULT) {
+		reject_mbo(mbo);
+		while (!try_start_dim_transfer(hdm_ch))
+			continue;
+	}
+
+	return 0;
+}
+
 /**
  * request_netinfo - triggers retrieving of network info
  * @iface: pointer to the interface
@@ -721,6 +797,21 @@ static int poison_channel(struct most_interface *most_iface, int ch_idx)
 	return ret;
 }
 
+/**
+ * set_irq_affinity - sets the affinity hint of the interrupts
+ * @iface: pointer to the interface
+ * @mask: CPUs of the channels
+ */
+static void set_irq_affinity(struct most_interface *most_iface,
+			     const struct cpumask *mask)
+{
+	struct dim2_hdm *dev = iface_to_hdm(most_iface);
+
+	cpumask_copy(&dev->irq_affinity, mask);
+	irq_set_affinity_hint(dev->ahb_irq, &dev->irq_affinity);
+	irq_set_affinity_hint(dev->mlb_irq, &dev->irq_affinity);
+}
+
 /*
  * dim2_probe - dim2 probe handler
  * @pdev: platform device structure
@@ -760,6 +851,7 @@ static int dim2_probe(struct platform_device *pdev)
 		dev_err(&pdev->dev, "failed to request ahb0_int irq %d\n", irq);
 		return ret;
 	}
+	dev->ahb_irq = irq;
 
 	irq = platform_get_irq(pdev, 1);
 	if (irq < 0) {
@@ -773,6 +865,7 @@ static int dim2_probe(struct platform_device *pdev)
 		dev_err(&pdev->dev, "failed to request mlb_int irq %d\n", irq);
 		return ret;
 	}
+	dev->mlb_irq = irq;
 
 	init_waitqueue_head(&dev->netinfo_waitq);
 	dev->deliver_netinfo = 0;
@@ -819,8 +912,11 @@ static int dim2_probe(struct platform_device *pdev)
 	dev->most_iface.channel_vector = dev->capabilities;
 	dev->most_iface.configure = configure_channel;
 	dev->most_iface.enqueue = enqueue;
+	dev->most_iface.enqueue_atomic = true;
+	dev->most_iface.enqueue_batch = enqueue_batch;
 	dev->most_iface.poison_channel = poison_channel;
 	dev->most_iface.request_netinfo = request_netinfo;
+	dev->most_iface.set_irq_affinity = set_irq_affinity;
 
 	kobj = most_register_interface(&dev->most_iface);
 	if (IS_ERR(kobj)) {
@@ -845,6 +941,8 @@ err_destroy_bus:
 	dim2_sysfs_destroy(&dev->bus);
 err_unreg_iface:
 	most_deregister_interface(&dev->most_iface);
+	irq_set_affinity_hint(dev->ahb_irq, NULL);
+	irq_set_affinity_hint(dev->mlb_irq, NULL);
 err_stop_thread:
 	kthread_stop(dev->netinfo_task);
 
@@ -872,6 +970,8 @@ static int dim2_remove(struct platform_device *pdev)
 
 	dim2_sysfs_destroy(&dev->bus);
 	most_deregister_interface(&dev->most_iface);
+	irq_set_affinity_hint(dev->ahb_irq, NULL);
+	irq_set_affinity_hint(dev->mlb_irq, NULL);
 	kthread_stop(dev->netinfo_task);
 
 	/*
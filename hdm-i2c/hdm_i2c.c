@@ -245,7 +245,7 @@ static void do_rx_work(struct hdm_i2c *dev)
 	list_del(&mbo->list);
 	mutex_unlock(&dev->rx.list_mutex);
 
-	mbo->processed_length = min(data_size, mbo->buffer_length);
+	mbo->processed_length = min_t(u32, data_size, mbo->buffer_length);
 	memcpy(mbo->virt_address, msg, mbo->processed_length);
 	mbo->status = MBO_SUCCESS;
 	mbo->complete(mbo);
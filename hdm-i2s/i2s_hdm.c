@@ -104,6 +104,7 @@ struct i2s_bus_obj;
  * @clk_gen_base: I/O register base address for clock generator IP
  * @clock_source: clock input signal
  * @completed_list: list head to hold completed MBOs from all channels
+ * @irq_affinity: affinity hint of the IRQ
  */
 struct hdm_i2s {
 	struct i2s_channel ch[DMA_CHANNELS];
@@ -117,6 +118,7 @@ struct hdm_i2s {
 	enum i2s_clk_source clk_source;
 	u8 is_enabled;
 	struct i2s_bus_obj *bus;
+	struct cpumask irq_affinity;
 };
 
 #define iface_to_hdm(iface) container_of(iface, struct hdm_i2s, most_iface)
@@ -741,6 +743,7 @@ static int start_data_transfer(struct hdm_i2s *dev, int ch_idx)
 	unsigned long offset = ch_idx * 0x08;
 	unsigned long i, noofquadlet;
 	unsigned long flags;
+	ktime_t ts = ktime_get(); /* service request of the FIFO */
 	struct mbo *mbo;
 	u32 *qptr;
 
@@ -769,6 +772,7 @@ static int start_data_transfer(struct hdm_i2s *dev, int ch_idx)
 	list_del(head->next);
 	mbo->processed_length = mbo->buffer_length;
 	mbo->status = MBO_SUCCESS;
+	mbo->hw_ts = ts;
 	mbo->complete(mbo);
 
 	/* Reset ready flag and reenable interrupts */
@@ -1211,6 +1215,15 @@ static int poison_channel(struct most_interface *most_iface, int ch_idx)
 	return 0;
 }
 
+static void set_irq_affinity(struct most_interface *most_iface,
+			     const struct cpumask *mask)
+{
+	struct hdm_i2s *dev = iface_to_hdm(most_iface);
+
+	cpumask_copy(&dev->irq_affinity, mask);
+	irq_set_affinity_hint(dev->irq, &dev->irq_affinity);
+}
+
 static struct of_device_id i2s_id[] = {
 	{ .compatible = "xlnx,axi4-i2s-1.00.b", },
 	{},
@@ -1359,6 +1372,7 @@ static int i2s_probe(struct platform_device *pdev)
 	dev->most_iface.configure = configure_channel;
 	dev->most_iface.enqueue = enqueue;
 	dev->most_iface.poison_channel = poison_channel;
+	dev->most_iface.set_irq_affinity = set_irq_affinity;
 
 	kobj = most_register_interface(&dev->most_iface);
 	if (IS_ERR(kobj)) {
@@ -1390,6 +1404,7 @@ err_destroy_i2s_bus_obj:
 	destroy_i2s_bus_obj(dev->bus);
 err_unreg_iface:
 	most_deregister_interface(&dev->most_iface);
+	irq_set_affinity_hint(dev->irq, NULL);
 err_unmap_io_clkgen:
 	iounmap(dev->clk_gen_base);
 err_release_mem_clkgen:
@@ -1419,9 +1434,11 @@ static int i2s_remove(struct platform_device *pdev)
 	(void)of_address_to_resource(clk_gen_node, 0, &res_clkgen);
 
 	i2s_disable(dev);
-	free_irq(dev->irq, dev);
 	destroy_i2s_bus_obj(dev->bus);
+	/* no set_cpu_affinity write may install the hint again after this */
 	most_deregister_interface(&dev->most_iface);
+	irq_set_affinity_hint(dev->irq, NULL);
+	free_irq(dev->irq, dev);
 	iounmap(dev->clk_gen_base);
 	release_mem_region(res_clkgen.start, resource_size(&res_clkgen));
 	iounmap(dev->i2s_base);
@@ -0,0 +1,631 @@
+/*
+ * hdm_loopback.c - Software loopback Hardware Dependent Module
+ *
+ * Copyright (C) 2013-2017, Microchip Technology Germany II GmbH & Co. KG
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This file is licensed under GPLv2.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/io.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+
+#include <mostcore.h>
+
+#define MAX_PAIRS	16
+#define MAX_BUFFERS	64
+#define MAX_BUF_SIZE	(1024 * 1024)
+
+/* Number of TX/RX channel pairs */
+static unsigned int num_pairs = 4;
+module_param(num_pairs, uint, 0444);
+MODULE_PARM_DESC(num_pairs, "Number of TX/RX channel pairs. Default = 4");
+
+struct lb_pair;
+
+/**
+ * struct lb_channel - loopback channel
+ * @kobj: sysfs directory holding the channel limits
+ * @name: channel name suffix
+ * @pair: pair the channel belongs to
+ * @is_open: channel has been configured by the core
+ * @pending: MBOs handed over by the core and not yet completed
+ * @due: completion deadlines of the pending TX MBOs (ring)
+ * @due_head: index of the oldest deadline
+ * @due_count: number of valid deadlines
+ * @busy_until: time at which the channel is able to take the next byte
+ * @bandwidth: bytes per second, 0 means unlimited
+ * @latency_us: additional completion latency in microseconds
+ * @max_mbo_size: upper limit for the buffer size applied on configure
+ */
+struct lb_channel {
+	struct kobject kobj;
+	char name[sizeof "rxNN"];
+	struct lb_pair *pair;
+	bool is_open;
+	struct list_head pending;
+	ktime_t due[MAX_BUFFERS];
+	unsigned int due_head;
+	unsigned int due_count;
+	ktime_t busy_until;
+	u32 bandwidth;
+	u32 latency_us;
+	u32 max_mbo_size;
+};
+
+#define to_lb_channel(k) container_of(k, struct lb_channel, kobj)
+
+/**
+ * struct lb_pair - TX channel looped back to an RX channel
+ * @tx: transmitting channel
+ * @rx: receiving channel
+ * @lock: protects both channels of the pair
+ * @timer: fires when the deadline of the oldest TX MBO is reached
+ * @xfer_work: moves data from TX to RX and completes the MBOs
+ */
+struct lb_pair {
+	struct lb_channel tx;
+	struct lb_channel rx;
+	spinlock_t lock; /* sync pair access */
+	struct hrtimer timer;
+	struct work_struct xfer_work;
+};
+
+/**
+ * struct lb_dev - loopback interface instance
+ * @most_iface: interface registered with the core
+ * @capabilities: channel capabilities, TX on even and RX on odd indices
+ * @pairs: channel pairs
+ * @lb_kobj: parent sysfs directory of the channel limits
+ */
+struct lb_dev {
+	struct most_interface most_iface;
+	struct most_channel_capability capabilities[2 * MAX_PAIRS];
+	struct lb_pair pairs[MAX_PAIRS];
+	struct kobject *lb_kobj;
+};
+
+#define to_lb_dev(iface) container_of(iface, struct lb_dev, most_iface)
+
+static struct lb_dev *lb_dev;
+
+static inline struct lb_channel *get_lb_channel(struct lb_dev *dev, int idx)
+{
+	struct lb_pair *pair = dev->pairs + idx / 2;
+
+	return idx & 1 ? &pair->rx : &pair->tx;
+}
+
+/**
+ * lb_xfer_ns - time needed to transport a buffer on a channel
+ * @ch: loopback channel
+ * @len: number of bytes
+ */
+static u64 lb_xfer_ns(struct lb_channel *ch, unsigned int len)
+{
+	if (!ch->bandwidth)
+		return 0;
+	return div_u64((u64)len * NSEC_PER_SEC, ch->bandwidth);
+}
+
+static void complete_all_mbos(struct list_head *head, int status)
+{
+	struct mbo *mbo, *tmp;
+
+	list_for_each_entry_safe(mbo, tmp, head, list) {
+		list_del(&mbo->list);
+		mbo->processed_length = 0;
+		mbo->status = status;
+		mbo->complete(mbo);
+	}
+}
+
+/**
+ * lb_xfer_work - work function of a channel pair
+ * @ws: work_struct of the pair
+ *
+ * Copies the payload of every TX MBO whose deadline has passed into the
+ * next free RX MBO and completes both. If the RX channel is not open the
+ * TX data is dropped. If it is open but has no free buffer, the pair waits
+ * for the core to enqueue one.
+ */
+static void lb_xfer_work(struct work_struct *ws)
+{
+	struct lb_pair *pair = container_of(ws, struct lb_pair, xfer_work);
+	struct lb_channel *tx = &pair->tx;
+	struct lb_channel *rx = &pair->rx;
+	struct mbo *tx_mbo, *rx_mbo;
+	unsigned long flags;
+	unsigned int len;
+	ktime_t due;
+
+	for (;;) {
+		spin_lock_irqsave(&pair->lock, flags);
+		if (!tx->is_open || list_empty(&tx->pending) ||
+		    (rx->is_open && list_empty(&rx->pending))) {
+			spin_unlock_irqrestore(&pair->lock, flags);
+			return;
+		}
+
+		due = tx->due[tx->due_head];
+		if (ktime_before(ktime_get(), due)) {
+			hrtimer_start(&pair->timer, due, HRTIMER_MODE_ABS);
+			spin_unlock_irqrestore(&pair->lock, flags);
+			return;
+		}
+
+		tx_mbo = list_first_entry(&tx->pending, struct mbo, list);
+		list_del(&tx_mbo->list);
+		tx->due_head = (tx->due_head + 1) % MAX_BUFFERS;
+		tx->due_count--;
+
+		rx_mbo = NULL;
+		if (rx->is_open) {
+			rx_mbo = list_first_entry(&rx->pending, struct mbo,
+						  list);
+			list_del(&rx_mbo->list);
+		}
+		spin_unlock_irqrestore(&pair->lock, flags);
+
+		if (rx_mbo) {
+			len = min(tx_mbo->buffer_length, rx_mbo->buffer_length);
+			memcpy(rx_mbo->virt_address, tx_mbo->virt_address, len);
+			rx_mbo->processed_length = len;
+			rx_mbo->status = MBO_SUCCESS;
+			rx_mbo->hw_ts = due; /* end of the simulated transfer */
+			rx_mbo->complete(rx_mbo);
+		}
+
+		tx_mbo->processed_length = tx_mbo->buffer_length;
+		tx_mbo->status = MBO_SUCCESS;
+		tx_mbo->hw_ts = due;
+		tx_mbo->complete(tx_mbo);
+	}
+}
+
+static enum hrtimer_restart lb_timer_fn(struct hrtimer *timer)
+{
+	struct lb_pair *pair = container_of(timer, struct lb_pair, timer);
+
+	queue_work(system_highpri_wq, &pair->xfer_work);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * configure_channel - called from MOST core to configure a channel
+ * @most_iface: interface the channel belongs to
+ * @ch_idx: channel to be configured
+ * @cfg: structure that holds the configuration information
+ *
+ * Return 0 on success, negative on failure.
+ */
+static int configure_channel(struct most_interface *most_iface, int ch_idx,
+			     struct most_channel_config *cfg)
+{
+	struct lb_dev *dev = to_lb_dev(most_iface);
+	struct lb_channel *ch;
+	unsigned long flags;
+
+	if (ch_idx < 0 || ch_idx >= most_iface->num_channels)
+		return -ECHRNG;
+
+	ch = get_lb_channel(dev, ch_idx);
+	if (ch->is_open)
+		return -EPERM;
+
+	if (cfg->direction != dev->capabilities[ch_idx].direction) {
+		pr_err("%s: bad direction\n", ch->name);
+		return -EPERM;
+	}
+
+	if (!cfg->num_buffers || !cfg->buffer_size) {
+		pr_err("%s: buffer size or #buffers zero\n", ch->name);
+		return -EINVAL;
+	}
+
+	if (cfg->buffer_size > ch->max_mbo_size) {
+		pr_warn("%s: fixed buffer size (%d -> %d)\n", ch->name,
+			cfg->buffer_size, ch->max_mbo_size);
+		cfg->buffer_size = ch->max_mbo_size;
+	}
+
+	if (cfg->num_buffers > MAX_BUFFERS) {
+		pr_warn("%s: fixed number of buffers (%d -> %d)\n", ch->name,
+			cfg->num_buffers, MAX_BUFFERS);
+		cfg->num_buffers = MAX_BUFFERS;
+	}
+
+	spin_lock_irqsave(&ch->pair->lock, flags);
+	ch->due_head = 0;
+	ch->due_count = 0;
+	ch->busy_until = ktime_get();
+	ch->is_open = true;
+	spin_unlock_irqrestore(&ch->pair->lock, flags);
+
+	return 0;
+}
+
+/**
+ * enqueue - called from MOST core to enqueue a buffer for data transfer
+ * @most_iface: intended interface
+ * @ch_idx: ID of the channel the buffer is intended for
+ * @mbo: pointer to the buffer object
+ *
+ * Return 0 on success, negative on failure.
+ *
+ * A TX buffer gets its completion deadline from the bandwidth and latency
+ * limits of both channels of the pair. RX buffers are kept until a TX
+ * buffer delivers data for them.
+ */
+static int enqueue(struct most_interface *most_iface, int ch_idx,
+		   struct mbo *mbo)
+{
+	struct lb_dev *dev = to_lb_dev(most_iface);
+	struct lb_channel *ch = get_lb_channel(dev, ch_idx);
+	struct lb_pair *pair = ch->pair;
+	struct lb_channel *rx = &pair->rx;
+	unsigned long flags;
+	ktime_t now, start;
+	u64 xfer_ns;
+	u32 latency_us;
+
+	spin_lock_irqsave(&pair->lock, flags);
+	if (unlikely(!ch->is_open)) {
+		spin_unlock_irqrestore(&pair->lock, flags);
+		return -EPERM;
+	}
+
+	if (ch == rx) {
+		list_add_tail(&mbo->list, &rx->pending);
+		spin_unlock_irqrestore(&pair->lock, flags);
+		queue_work(system_highpri_wq, &pair->xfer_work);
+		return 0;
+	}
+
+	if (unlikely(ch->due_count == MAX_BUFFERS)) {
+		spin_unlock_irqrestore(&pair->lock, flags);
+		return -ENOSPC;
+	}
+
+	now = ktime_get();
+	start = ktime_after(ch->busy_until, now) ? ch->busy_until : now;
+	xfer_ns = lb_xfer_ns(ch, mbo->buffer_length);
+	latency_us = ch->latency_us;
+	if (rx->is_open) {
+		if (ktime_after(rx->busy_until, start))
+			start = rx->busy_until;
+		xfer_ns = max(xfer_ns, lb_xfer_ns(rx, mbo->buffer_length));
+		latency_us += rx->latency_us;
+		rx->busy_until = ktime_add_ns(start, xfer_ns);
+	}
+	ch->busy_until = ktime_add_ns(start, xfer_ns);
+	ch->due[(ch->due_head + ch->due_count) % MAX_BUFFERS] =
+		ktime_add_us(ch->busy_until, latency_us);
+	ch->due_count++;
+	list_add_tail(&mbo->list, &ch->pending);
+	spin_unlock_irqrestore(&pair->lock, flags);
+
+	queue_work(system_highpri_wq, &pair->xfer_work);
+	return 0;
+}
+
+/**
+ * poison_channel - called from MOST core to poison buffers of a channel
+ * @most_iface: pointer to the interface the channel belongs to
+ * @ch_idx: corresponding channel ID
+ *
+ * Return 0 on success, negative on failure.
+ *
+ * Completes all pending buffers of the channel with status MBO_E_CLOSE.
+ */
+static int poison_channel(struct most_interface *most_iface, int ch_idx)
+{
+	struct lb_dev *dev = to_lb_dev(most_iface);
+	struct lb_channel *ch = get_lb_channel(dev, ch_idx);
+	unsigned long flags;
+	LIST_HEAD(head);
+
+	spin_lock_irqsave(&ch->pair->lock, flags);
+	if (!ch->is_open) {
+		spin_unlock_irqrestore(&ch->pair->lock, flags);
+		return -EPERM;
+	}
+	ch->is_open = false;
+	ch->due_count = 0;
+	list_splice_init(&ch->pending, &head);
+	spin_unlock_irqrestore(&ch->pair->lock, flags);
+
+	complete_all_mbos(&head, MBO_E_CLOSE);
+
+	/* a TX channel may be waiting for RX buffers that never come */
+	queue_work(system_highpri_wq, &ch->pair->xfer_work);
+	return 0;
+}
+
+static void request_netinfo(struct most_interface *most_iface, int ch_idx)
+{
+}
+
+static int alloc_mbo_buf(struct most_interface *most_iface, int ch_idx,
+			 struct mbo *mbo, size_t size)
+{
+	mbo->virt_address = kzalloc(size, GFP_KERNEL);
+	if (!mbo->virt_address)
+		return -ENOMEM;
+	mbo->bus_address = virt_to_phys(mbo->virt_address);
+	return 0;
+}
+
+static void free_mbo_buf(struct most_interface *most_iface, int ch_idx,
+			 struct mbo *mbo, size_t size)
+{
+	kfree(mbo->virt_address);
+}
+
+/*		     ___	 ___
+ *		     ___S Y S F S___
+ */
+
+struct lb_attr {
+	struct attribute attr;
+	ssize_t (*show)(struct lb_channel *ch, char *buf);
+	ssize_t (*store)(struct lb_channel *ch, const char *buf, size_t count);
+};
+
+#define to_lb_attr(a) container_of(a, struct lb_attr, attr)
+
+static ssize_t bandwidth_show(struct lb_channel *ch, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", ch->bandwidth);
+}
+
+static ssize_t bandwidth_store(struct lb_channel *ch, const char *buf,
+			       size_t count)
+{
+	int ret = kstrtou32(buf, 0, &ch->bandwidth);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t latency_us_show(struct lb_channel *ch, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", ch->latency_us);
+}
+
+static ssize_t latency_us_store(struct lb_channel *ch, const char *buf,
+				size_t count)
+{
+	int ret = kstrtou32(buf, 0, &ch->latency_us);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t max_mbo_size_show(struct lb_channel *ch, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", ch->max_mbo_size);
+}
+
+static ssize_t max_mbo_size_store(struct lb_channel *ch, const char *buf,
+				  size_t count)
+{
+	u32 val;
+	int ret = kstrtou32(buf, 0, &val);
+
+	if (ret)
+		return ret;
+	if (!val)
+		return -EINVAL;
+	ch->max_mbo_size = val;
+	return count;
+}
+
+static struct lb_attr lb_attrs[] = {
+	__ATTR_RW(bandwidth),
+	__ATTR_RW(latency_us),
+	__ATTR_RW(max_mbo_size),
+};
+
+static struct attribute *lb_def_attrs[] = {
+	&lb_attrs[0].attr,
+	&lb_attrs[1].attr,
+	&lb_attrs[2].attr,
+	NULL,
+};
+
+static ssize_t lb_attr_show(struct kobject *kobj, struct attribute *attr,
+			    char *buf)
+{
+	struct lb_attr *xattr = to_lb_attr(attr);
+
+	if (!xattr->show)
+		return -EIO;
+
+	return xattr->show(to_lb_channel(kobj), buf);
+}
+
+static ssize_t lb_attr_store(struct kobject *kobj, struct attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct lb_attr *xattr = to_lb_attr(attr);
+
+	if (!xattr->store)
+		return -EIO;
+
+	return xattr->store(to_lb_channel(kobj), buf, count);
+}
+
+static const struct sysfs_ops lb_sysfs_ops = {
+	.show = lb_attr_show,
+	.store = lb_attr_store,
+};
+
+static void lb_kobj_release(struct kobject *kobj)
+{
+}
+
+static struct kobj_type lb_ktype = {
+	.release = lb_kobj_release,
+	.sysfs_ops = &lb_sysfs_ops,
+	.default_attrs = lb_def_attrs,
+};
+
+static void init_lb_channel(struct lb_channel *ch, struct lb_pair *pair,
+			    const char *fmt, int idx)
+{
+	snprintf(ch->name, sizeof(ch->name), fmt, idx);
+	ch->pair = pair;
+	ch->is_open = false;
+	ch->max_mbo_size = MAX_BUF_SIZE;
+	INIT_LIST_HEAD(&ch->pending);
+}
+
+static void destroy_lb_kobjs(struct lb_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < num_pairs; i++) {
+		kobject_put(&dev->pairs[i].tx.kobj);
+		kobject_put(&dev->pairs[i].rx.kobj);
+	}
+	kobject_put(dev->lb_kobj);
+}
+
+static int create_lb_kobjs(struct lb_dev *dev, struct kobject *parent)
+{
+	struct lb_channel *ch;
+	int i, err;
+
+	dev->lb_kobj = kobject_create_and_add("loopback", parent);
+	if (!dev->lb_kobj)
+		return -ENOMEM;
+
+	for (i = 0; i < 2 * num_pairs; i++) {
+		ch = get_lb_channel(dev, i);
+		kobject_init(&ch->kobj, &lb_ktype);
+	}
+
+	for (i = 0; i < 2 * num_pairs; i++) {
+		ch = get_lb_channel(dev, i);
+		err = kobject_add(&ch->kobj, dev->lb_kobj, "%s", ch->name);
+		if (err) {
+			pr_err("kobject_add() failed: %d\n", err);
+			destroy_lb_kobjs(dev);
+			return err;
+		}
+	}
+	return 0;
+}
+
+static int __init hdm_lb_init(void)
+{
+	struct most_channel_capability *cap;
+	struct lb_pair *pair;
+	struct kobject *kobj;
+	int i, err;
+
+	if (!num_pairs || num_pairs > MAX_PAIRS) {
+		pr_err("num_pairs must be in range 1..%d\n", MAX_PAIRS);
+		return -EINVAL;
+	}
+
+	lb_dev = kzalloc(sizeof(*lb_dev), GFP_KERNEL);
+	if (!lb_dev)
+		return -ENOMEM;
+
+	for (i = 0; i < num_pairs; i++) {
+		pair = lb_dev->pairs + i;
+		spin_lock_init(&pair->lock);
+		hrtimer_init(&pair->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+		pair->timer.function = lb_timer_fn;
+		INIT_WORK(&pair->xfer_work, lb_xfer_work);
+		init_lb_channel(&pair->tx, pair, "tx%d", i);
+		init_lb_channel(&pair->rx, pair, "rx%d", i);
+	}
+
+	for (i = 0; i < 2 * num_pairs; i++) {
+		cap = lb_dev->capabilities + i;
+		cap->name_suffix = get_lb_channel(lb_dev, i)->name;
+		cap->direction = i & 1 ? MOST_CH_RX : MOST_CH_TX;
+		cap->data_type = MOST_CH_CONTROL | MOST_CH_ASYNC |
+				 MOST_CH_ISOC | MOST_CH_SYNC;
+		cap->num_buffers_packet = MAX_BUFFERS;
+		cap->buffer_size_packet = MAX_BUF_SIZE;
+		cap->num_buffers_streaming = MAX_BUFFERS;
+		cap->buffer_size_streaming = MAX_BUF_SIZE;
+		/* configure() limits the number of buffers */
+		cap->live_config = MOST_CFG_BUFFER_SIZE;
+	}
+
+	lb_dev->most_iface.mod = THIS_MODULE;
+	lb_dev->most_iface.interface = ITYPE_LOOPBACK;
+	lb_dev->most_iface.description = "loopback";
+	lb_dev->most_iface.num_channels = 2 * num_pairs;
+	lb_dev->most_iface.channel_vector = lb_dev->capabilities;
+	lb_dev->most_iface.configure = configure_channel;
+	lb_dev->most_iface.enqueue = enqueue;
+	lb_dev->most_iface.enqueue_atomic = true;
+	lb_dev->most_iface.poison_channel = poison_channel;
+	lb_dev->most_iface.request_netinfo = request_netinfo;
+	lb_dev->most_iface.alloc_mbo_buf = alloc_mbo_buf;
+	lb_dev->most_iface.free_mbo_buf = free_mbo_buf;
+
+	kobj = most_register_interface(&lb_dev->most_iface);
+	if (IS_ERR(kobj)) {
+		pr_err("Failed to register loopback interface\n");
+		err = PTR_ERR(kobj);
+		goto err_free;
+	}
+
+	err = create_lb_kobjs(lb_dev, kobj);
+	if (err)
+		goto err_unreg_iface;
+
+	return 0;
+
+err_unreg_iface:
+	most_deregister_interface(&lb_dev->most_iface);
+err_free:
+	kfree(lb_dev);
+	return err;
+}
+
+static void __exit hdm_lb_exit(void)
+{
+	struct lb_pair *pair;
+	int i;
+
+	destroy_lb_kobjs(lb_dev);
+	most_deregister_interface(&lb_dev->most_iface);
+
+	for (i = 0; i < num_pairs; i++) {
+		pair = lb_dev->pairs + i;
+		hrtimer_cancel(&pair->timer);
+		cancel_work_sync(&pair->xfer_work);
+	}
+	kfree(lb_dev);
+}
+
+module_init(hdm_lb_init);
+module_exit(hdm_lb_exit);
+
+MODULE_DESCRIPTION("Software Loopback Hardware Dependent Module");
+MODULE_LICENSE("GPL");
@@ -38,7 +38,7 @@
 #define MAX_NUM_ENDPOINTS	30
 #define MAX_SUFFIX_LEN		10
 #define MAX_STRING_LEN		80
-#define MAX_BUF_SIZE		0xFFFF
+#define MAX_BUF_SIZE		(1024 * 1024)
 
 #define USB_VENDOR_ID_SMSC	0x0424  /* VID: SMSC */
 #define USB_DEV_ID_BRDG		0xC001  /* PID: USB Bridge */
@@ -106,6 +106,10 @@ struct clear_hold_work {
  * @io_mutex: synchronize I/O with disconnect
  * @link_stat_timer: timer for link status reports
  * @poll_work_obj: work for polling link status
+ * @done_lock: synchronize access to done_list
+ * @done_list: completed MBOs to be returned to the core by hdm_poll()
+ * @polling: number of hdm_poll() calls in progress
+ * @poll_wq: wait queue to wait for hdm_poll() to finish
  */
 struct most_dev {
 	struct kobject *parent;
@@ -125,6 +129,10 @@ struct most_dev {
 	struct mutex io_mutex;
 	struct timer_list link_stat_timer;
 	struct work_struct poll_work_obj;
+	spinlock_t done_lock; /* sync done_list */
+	struct list_head done_list;
+	atomic_t polling;
+	wait_queue_head_t poll_wq;
 };
 
 #define to_mdev(d) container_of(d, struct most_dev, iface)
@@ -132,6 +140,7 @@ struct most_dev {
 
 static void wq_clear_halt(struct work_struct *wq_obj);
 static void wq_netinfo(struct work_struct *wq_obj);
+static void hdm_flush_done(struct most_dev *mdev, int channel);
 
 /**
  * drci_rd_reg - read a DCI register
@@ -263,6 +272,7 @@ static int hdm_poison_channel(struct most_interface *iface, int channel)
 		cancel_work_sync(&mdev->poll_work_obj);
 	}
 	mutex_unlock(&mdev->io_mutex);
+	hdm_flush_done(mdev, channel);
 	return 0;
 }
 
@@ -328,14 +338,128 @@ static int hdm_remove_padding(struct most_dev *mdev, int channel,
 	return 0;
 }
 
+/**
+ * hdm_complete_mbo - queues a completed MBO for the core
+ * @mdev: most device
+ * @mbo: completed buffer object
+ *
+ * The MBOs are returned to the core in hdm_poll(), which runs in softirq
+ * context with a budget. The completion time is taken here, since it may
+ * be a while until the poll runs.
+ */
+static void hdm_complete_mbo(struct most_dev *mdev, struct mbo *mbo)
+{
+	unsigned long flags;
+
+	if (unlikely(!mbo->complete))
+		return;
+
+	mbo->hw_ts = ktime_get();
+	spin_lock_irqsave(&mdev->done_lock, flags);
+	list_add_tail(&mbo->list, &mdev->done_list);
+	spin_unlock_irqrestore(&mdev->done_lock, flags);
+	most_poll_schedule(&mdev->iface);
+}
+
+/**
+ * hdm_flush_done - returns the completed MBOs of a channel at once
+ * @mdev: most device
+ * @channel: channel ID
+ *
+ * The core collects the MBOs of a poisoned channel right after
+ * hdm_poison_channel() returns, hence they must not be left to hdm_poll().
+ * A running hdm_poll() only takes the MBOs it completes from the done_list,
+ * so waiting for it to finish covers the ones it has taken already.
+ */
+static void hdm_flush_done(struct most_dev *mdev, int channel)
+{
+	struct mbo *mbo, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&mdev->done_lock, flags);
+	list_for_each_entry_safe(mbo, tmp, &mdev->done_list, list) {
+		if (mbo->hdm_channel_id == channel)
+			list_move_tail(&mbo->list, &done);
+	}
+	spin_unlock_irqrestore(&mdev->done_lock, flags);
+
+	smp_mb(); /* pairs with hdm_poll() */
+	wait_event(mdev->poll_wq, !atomic_read(&mdev->polling));
+
+	list_for_each_entry_safe(mbo, tmp, &done, list) {
+		list_del(&mbo->list);
+		mbo->complete(mbo);
+	}
+}
+
+/**
+ * hdm_poll - returns completed MBOs to the core
+ * @iface: interface
+ * @budget: maximum number of MBOs to be completed
+ *
+ * Up to budget MBOs are taken from the done_list, sorted by channel and
+ * handed to the core as one batch per channel.
+ *
+ * Returns the number of completed MBOs.
+ */
+static int hdm_poll(struct most_interface *iface, int budget)
+{
+	struct most_dev *mdev = to_mdev(iface);
+	struct list_head batch[MAX_NUM_ENDPOINTS];
+	struct mbo *mbo, *tmp;
+	unsigned long flags;
+	int i, n = 0;
+
+	for (i = 0; i < iface->num_channels; i++)
+		INIT_LIST_HEAD(&batch[i]);
+
+	atomic_inc(&mdev->polling);
+	smp_mb__after_atomic(); /* pairs with hdm_flush_done() */
+	spin_lock_irqsave(&mdev->done_lock, flags);
+	list_for_each_entry_safe(mbo, tmp, &mdev->done_list, list) {
+		if (n == budget)
+			break;
+		list_move_tail(&mbo->list, &batch[mbo->hdm_channel_id]);
+		n++;
+	}
+	spin_unlock_irqrestore(&mdev->done_lock, flags);
+
+	for (i = 0; i < iface->num_channels; i++) {
+		if (!list_empty(&batch[i]))
+			most_complete_batch(iface, i, &batch[i]);
+	}
+
+	if (atomic_dec_and_test(&mdev->polling))
+		wake_up(&mdev->poll_wq);
+	return n;
+}
+
+/**
+ * hdm_poll_complete - restarts polling for MBOs completed meanwhile
+ * @iface: interface
+ */
+static void hdm_poll_complete(struct most_interface *iface)
+{
+	struct most_dev *mdev = to_mdev(iface);
+	unsigned long flags;
+	bool pending;
+
+	spin_lock_irqsave(&mdev->done_lock, flags);
+	pending = !list_empty(&mdev->done_list);
+	spin_unlock_irqrestore(&mdev->done_lock, flags);
+	if (pending)
+		most_poll_schedule(iface);
+}
+
 /**
  * hdm_write_completion - completion function for submitted Tx URBs
  * @urb: the URB that has been completed
  *
  * This checks the status of the completed URB. In case the URB has been
  * unlinked before, it is immediately freed. On any other error the MBO
- * transfer flag is set. On success it frees allocated resources and calls
- * the completion function.
+ * transfer flag is set. On success it frees allocated resources and queues
+ * the MBO for completion.
  *
  * Context: interrupt!
  */
@@ -374,8 +498,7 @@ static void hdm_write_completion(struct urb *urb)
 
 	spin_unlock_irqrestore(lock, flags);
 
-	if (likely(mbo->complete))
-		mbo->complete(mbo);
+	hdm_complete_mbo(mdev, mbo);
 	usb_free_urb(urb);
 }
 
@@ -386,7 +509,7 @@ static void hdm_write_completion(struct urb *urb)
  * This checks the status of the completed URB. In case the URB has been
  * unlinked before it is immediately freed. On any other error the MBO transfer
  * flag is set. On success it frees allocated resources, removes
- * padding bytes -if necessary- and calls the completion function.
+ * padding bytes -if necessary- and queues the MBO for completion.
  *
  * Context: interrupt!
  *
@@ -530,14 +653,13 @@ static void hdm_read_completion(struct urb *urb)
 
 	spin_unlock_irqrestore(lock, flags);
 
-	if (likely(mbo->complete))
-		mbo->complete(mbo);
+	hdm_complete_mbo(mdev, mbo);
 	usb_free_urb(urb);
 }
 
 /**
- * hdm_enqueue - receive a buffer to be used for data transfer
- * @iface: interface to enqueue to
+ * hdm_submit_mbo - submit a buffer to the USB core
+ * @mdev: most device
  * @channel: ID of the channel
  * @mbo: pointer to the buffer object
  *
@@ -547,32 +669,16 @@ static void hdm_read_completion(struct urb *urb)
  *
  * Returns 0 on success. On any error the URB is freed and a error code
  * is returned.
- *
- * Context: Could in _some_ cases be interrupt!
  */
-static int hdm_enqueue(struct most_interface *iface, int channel,
-		       struct mbo *mbo)
+static int hdm_submit_mbo(struct most_dev *mdev, int channel, struct mbo *mbo)
 {
-	struct most_dev *mdev;
-	struct most_channel_config *conf;
-	struct device *dev;
+	struct most_channel_config *conf = &mdev->conf[channel];
+	struct device *dev = &mdev->usb_device->dev;
 	int retval = 0;
 	struct urb *urb;
 	unsigned long length;
 	void *virt_address;
 
-	if (unlikely(!iface || !mbo))
-		return -EIO;
-	if (unlikely(iface->num_channels <= channel || channel < 0))
-		return -ECHRNG;
-
-	mdev = to_mdev(iface);
-	conf = &mdev->conf[channel];
-	dev = &mdev->usb_device->dev;
-
-	if (!mdev->usb_device)
-		return -ENODEV;
-
 	urb = usb_alloc_urb(NO_ISOCHRONOUS_URB, GFP_ATOMIC);
 	if (!urb)
 		return -ENOMEM;
@@ -610,7 +716,7 @@ static int hdm_enqueue(struct most_interface *iface, int channel,
 
 	usb_anchor_urb(urb, &mdev->busy_urbs[channel]);
 
-	retval = usb_submit_urb(urb, GFP_KERNEL);
+	retval = usb_submit_urb(urb, GFP_ATOMIC);
 	if (retval) {
 		dev_err(dev, "URB submit failed with error %d.\n", retval);
 		goto _error_1;
@@ -624,6 +730,72 @@ _error:
 	return retval;
 }
 
+/**
+ * hdm_enqueue - receive a buffer to be used for data transfer
+ * @iface: interface to enqueue to
+ * @channel: ID of the channel
+ * @mbo: pointer to the buffer object
+ *
+ * Returns 0 on success, a negative error code otherwise.
+ *
+ * Context: Could in _some_ cases be interrupt! The core calls it directly
+ * from the context that submits the MBO, hence enqueue_atomic is set.
+ */
+static int hdm_enqueue(struct most_interface *iface, int channel,
+		       struct mbo *mbo)
+{
+	struct most_dev *mdev;
+
+	if (unlikely(!iface || !mbo))
+		return -EIO;
+	if (unlikely(iface->num_channels <= channel || channel < 0))
+		return -ECHRNG;
+
+	mdev = to_mdev(iface);
+	if (!mdev->usb_device)
+		return -ENODEV;
+
+	return hdm_submit_mbo(mdev, channel, mbo);
+}
+
+/**
+ * hdm_enqueue_batch - receive a list of buffers to be used for data transfer
+ * @iface: interface to enqueue to
+ * @channel: ID of the channel
+ * @mbos: list of buffer objects
+ *
+ * Submits the buffers in list order and removes each submitted buffer from
+ * the list. Buffers following a failed submission are left on the list.
+ *
+ * Returns 0 on success, a negative error code otherwise.
+ */
+static int hdm_enqueue_batch(struct most_interface *iface, int channel,
+			     struct list_head *mbos)
+{
+	struct most_dev *mdev;
+	struct mbo *mbo, *tmp;
+	int retval;
+
+	if (unlikely(!iface))
+		return -EIO;
+	if (unlikely(iface->num_channels <= channel || channel < 0))
+		return -ECHRNG;
+
+	mdev = to_mdev(iface);
+	if (!mdev->usb_device)
+		return -ENODEV;
+
+	list_for_each_entry_safe(mbo, tmp, mbos, list) {
+		list_del(&mbo->list);
+		retval = hdm_submit_mbo(mdev, channel, mbo);
+		if (retval) {
+			list_add(&mbo->list, mbos);
+			return retval;
+		}
+	}
+	return 0;
+}
+
 /**
  * hdm_configure_channel - receive channel configuration from core
  * @iface: interface
@@ -688,13 +860,19 @@ static int hdm_configure_channel(struct most_interface *iface, int channel,
 	num_frames = conf->buffer_size / frame_size;
 
 	if (conf->buffer_size % frame_size) {
-		u16 old_size = conf->buffer_size;
+		u32 old_size = conf->buffer_size;
 
 		conf->buffer_size = num_frames * frame_size;
-		dev_warn(dev, "%s: fixed buffer size (%d -> %d)\n",
+		dev_warn(dev, "%s: fixed buffer size (%u -> %u)\n",
 			 mdev->suffix[channel], old_size, conf->buffer_size);
 	}
 
+	if ((u64)num_frames * USB_MTU > MAX_BUF_SIZE) {
+		dev_warn(dev, "Misconfig: padded buffer exceeds %d bytes\n",
+			 MAX_BUF_SIZE);
+		return -EINVAL;
+	}
+
 	/* calculate extra length to comply w/ HW padding */
 	conf->extra_len = num_frames * (USB_MTU - frame_size);
 
@@ -709,6 +887,30 @@ exit:
 	return 0;
 }
 
+/**
+ * hdm_restart_channel - re-open a poisoned channel with its configuration
+ * @iface: interface
+ * @channel: channel ID
+ *
+ * The frame size calculations of hdm_configure_channel() are still valid
+ * and the streaming channels need no control transfer, so these are made
+ * healthy again right away. Async channels need to be configured again to
+ * re-sync their endpoint.
+ */
+static int hdm_restart_channel(struct most_interface *iface, int channel)
+{
+	struct most_dev *mdev = to_mdev(iface);
+	struct most_channel_config *conf = &mdev->conf[channel];
+
+	if (conf->data_type != MOST_CH_SYNC && conf->data_type != MOST_CH_ISOC)
+		return -EINVAL;
+
+	mdev->padding_active[channel] = conf->data_type == MOST_CH_SYNC ||
+					conf->packets_per_xact != 0xFF;
+	mdev->is_channel_healthy[channel] = true;
+	return 0;
+}
+
 /**
  * hdm_request_netinfo - request network information
  * @iface: pointer to interface
@@ -792,7 +994,8 @@ static void wq_netinfo(struct work_struct *wq_obj)
  * wq_clear_halt - work queue function
  * @wq_obj: work_struct object to execute
  *
- * This sends a clear_halt to the given USB pipe.
+ * This sends a clear_halt to the given USB pipe. User space learns of
+ * the stall by a uevent of the channel.
  */
 static void wq_clear_halt(struct work_struct *wq_obj)
 {
@@ -801,6 +1004,7 @@ static void wq_clear_halt(struct work_struct *wq_obj)
 	unsigned int channel = clear_work->channel;
 	int pipe = clear_work->pipe;
 
+	most_channel_event(&mdev->iface, channel, MOST_EV_STALL);
 	mutex_lock(&mdev->io_mutex);
 	most_stop_enqueue(&mdev->iface, channel);
 	usb_kill_anchored_urbs(&mdev->busy_urbs[channel]);
@@ -1145,6 +1349,10 @@ hdm_probe(struct usb_interface *interface, const struct usb_device_id *id)
 	usb_set_intfdata(interface, mdev);
 	num_endpoints = usb_iface_desc->desc.bNumEndpoints;
 	mutex_init(&mdev->io_mutex);
+	spin_lock_init(&mdev->done_lock);
+	INIT_LIST_HEAD(&mdev->done_list);
+	atomic_set(&mdev->polling, 0);
+	init_waitqueue_head(&mdev->poll_wq);
 	INIT_WORK(&mdev->poll_work_obj, wq_netinfo);
 	setup_timer(&mdev->link_stat_timer, link_stat_timer_handler,
 		    (unsigned long)mdev);
@@ -1157,9 +1365,14 @@ hdm_probe(struct usb_interface *interface, const struct usb_device_id *id)
 	mdev->iface.configure = hdm_configure_channel;
 	mdev->iface.request_netinfo = hdm_request_netinfo;
 	mdev->iface.enqueue = hdm_enqueue;
+	mdev->iface.enqueue_atomic = true;
+	mdev->iface.enqueue_batch = hdm_enqueue_batch;
 	mdev->iface.poison_channel = hdm_poison_channel;
+	mdev->iface.restart_channel = hdm_restart_channel;
 	mdev->iface.alloc_mbo_buf = hdm_alloc_mbo_buf;
 	mdev->iface.free_mbo_buf = hdm_free_mbo_buf;
+	mdev->iface.poll = hdm_poll;
+	mdev->iface.poll_complete = hdm_poll_complete;
 	mdev->iface.description = mdev->description;
 	mdev->iface.num_channels = num_endpoints;
 
@@ -1208,6 +1421,10 @@ hdm_probe(struct usb_interface *interface, const struct usb_device_id *id)
 		tmp_cap->num_buffers_streaming = BUF_CHAIN_SIZE;
 		tmp_cap->data_type = MOST_CH_CONTROL | MOST_CH_ASYNC |
 				     MOST_CH_ISOC | MOST_CH_SYNC;
+		tmp_cap->live_config = MOST_CFG_NUM_BUFFERS |
+				       MOST_CFG_BUFFER_SIZE |
+				       MOST_CFG_SUBBUFFER_SIZE |
+				       MOST_CFG_PACKETS_PER_XACT;
 		if (usb_endpoint_dir_in(ep_desc))
 			tmp_cap->direction = MOST_CH_RX;
 		else
@@ -25,19 +25,57 @@
 #include <linux/completion.h>
 #include <linux/sysfs.h>
 #include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
 #include <linux/dma-mapping.h>
 #include <linux/idr.h>
+#include <linux/ptr_ring.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/hashtable.h>
+#include <linux/stringhash.h>
+#include <linux/glob.h>
+#include <linux/irq_poll.h>
+#include <linux/hrtimer.h>
+#include <linux/ratelimit.h>
+#include <linux/bitops.h>
 #include "mostcore.h"
+#include "most_snapshot.h"
+
+#define CREATE_TRACE_POINTS
+#include "most_trace.h"
 
 #define MAX_CHANNELS	64
 #define STRING_SIZE	80
+#define CONFIG_INDEX_BITS	6
+#define MOST_SCHED_AUTO	-1
+#define POLL_WEIGHT	64
+#define EVENT_INTERVAL	HZ
+#define EVENT_BURST	10
+/* ptr_ring zeroes consumed slots in batches of up to this many */
+#define FIFO_HEADROOM	(2 * SMP_CACHE_BYTES / sizeof(void *))
+#define NQ_RETRY_MIN	msecs_to_jiffies(1)
+#define NQ_RETRY_MAX	msecs_to_jiffies(100)
+#define RECONF_TIMEOUT	(5 * HZ)
 
 static struct class *most_class;
 static struct device *core_dev;
 static struct ida mdev_id;
-static int dummy_num_buffers;
-static struct list_head config_probes = LIST_HEAD_INIT(config_probes);
-static struct mutex config_probes_mt; /* config_probes */
+static struct dentry *most_debugfs;
+static struct kmem_cache *mbo_cache;
+static atomic_t dummy_num_buffers;
+static DEFINE_HASHTABLE(config_index, CONFIG_INDEX_BITS);
+static DECLARE_RWSEM(config_probes_sem); /* config_index */
+
+static bool async_link;
+module_param(async_link, bool, 0644);
+MODULE_PARM_DESC(async_link, "Link the channels of a new interface in parallel. Default = 0");
 
 struct device *most_parent_device(void)
 {
@@ -48,7 +86,41 @@ EXPORT_SYMBOL_GPL(most_parent_device);
 struct most_c_aim_obj {
 	struct most_aim *ptr;
 	int refs;
-	int num_buffers;
+	atomic_t in_use; /* Tx buffers held by the AIM or in flight */
+	u16 weight;
+	u16 min_share;
+	struct list_head list;
+};
+
+enum most_c_stat {
+	STAT_BYTES,
+	STAT_PKTS,
+	STAT_E_INVAL,
+	STAT_E_CLOSE,
+	STAT_STARVED,
+	STAT_HALTED,
+	STAT_RESUMED,
+	STAT_NQ_HIGH,
+	STAT_NQ_LOW,
+	STAT_NUM
+};
+
+struct most_c_stats {
+	u64 cnt[STAT_NUM];
+	struct u64_stats_sync syncp;
+};
+
+#define HIST_BUCKETS 32
+
+enum most_c_hist {
+	HIST_QUEUE,	/* submitted until handed to the HDM */
+	HIST_HDM,	/* handed to the HDM until completed */
+	HIST_AIM,	/* held by the AIM */
+	HIST_NUM
+};
+
+struct most_c_hist_buckets {
+	u64 cnt[HIST_NUM][HIST_BUCKETS];
 };
 
 struct most_c_obj {
@@ -56,6 +128,7 @@ struct most_c_obj {
 	struct completion cleanup;
 	atomic_t mbo_ref;
 	atomic_t mbo_nq_level;
+	atomic_t seq; /* of the next completed MBO, kept across restarts */
 	u16 channel_id;
 	bool is_poisoned;
 	struct mutex start_mutex;
@@ -65,23 +138,388 @@ struct most_c_obj {
 	struct most_inst_obj *inst;
 	struct most_channel_config cfg;
 	bool keep_mbo;
+	bool park_mbo; /* stopping, keep the MBOs in mbo_pool */
+	struct list_head mbo_pool; /* MBOs kept while stopped */
+	struct most_channel_config pool_cfg;
+	u16 min_buffers; /* elastic pool settings */
+	u16 max_buffers;
+	unsigned int idle_time; /* ms */
+	bool elastic; /* elastic pool of the running channel */
+	int elastic_min;
+	int elastic_max;
+	int elastic_step;
+	atomic_t mbo_surplus; /* MBOs to be retired on their return */
+	struct work_struct grow_work;
+	struct delayed_work shrink_work;
+	struct work_struct link_work;
+	ktime_t link_time; /* spent in the configuration sets */
+	int sched_policy; /* of the threads serving the channel */
+	unsigned int sched_priority;
+	struct cpumask cpu_affinity;
+	unsigned int coalesce_frames; /* Tx buffers per AIM notification */
+	unsigned int coalesce_usecs; /* max. delay of a notification */
+	atomic_t tx_pending; /* Tx buffers not yet notified */
+	struct hrtimer coalesce_timer;
+	unsigned long events; /* pending MOST_EV_* bits */
+	struct delayed_work event_work;
+	struct ratelimit_state event_rs;
+	struct most_channel_config hdm_cfg; /* last applied by configure() */
+	bool hdm_cfg_valid;
+	bool stop_pending; /* most_stop_channel_async() in progress */
+	struct work_struct stop_work;
+	struct most_aim *stop_aim;
+	void (*stop_done)(struct most_interface *iface, int id, void *priv);
+	void *stop_priv;
+	bool stop_restart; /* stop_work restarts the channel */
 	bool enqueue_halt;
-	struct list_head fifo;
+	bool nq_busy; /* enqueue() in progress, protected by fifo_lock */
+	struct ptr_ring fifo; /* free MBOs */
 	spinlock_t fifo_lock;
 	struct list_head halt_fifo;
 	struct list_head list;
-	struct most_c_aim_obj aim0;
-	struct most_c_aim_obj aim1;
+	struct list_head aim_list; /* links, removed only on release */
+	int aim_refs; /* starts of all linked AIMs */
+	int aims_running; /* linked AIMs that started the channel */
 	struct list_head trash_fifo;
+	struct work_struct trash_work; /* frees the MBOs in trash_fifo */
 	struct task_struct *hdm_enqueue_task;
 	wait_queue_head_t hdm_fifo_wq;
-	struct {
-		ulong bytes, pkts;
-	} stats;
+	struct most_c_stats __percpu *stats;
+	struct most_c_hist_buckets __percpu *hist;
+	void *region_virt; /* coherent memory of all buffers, if not NULL */
+	dma_addr_t region_bus;
+	size_t region_size;
 };
 
 #define to_c_obj(d) container_of(d, struct most_c_obj, kobj)
 
+/**
+ * get_aim_link - returns the link of an AIM to a channel
+ * @c: pointer to channel object
+ * @aim: AIM to look for
+ *
+ * Links are added to aim_list under the start_mutex and are not removed
+ * before the channel is released, hence the list may be walked by the
+ * completion routines under rcu_read_lock(). An unlinked AIM leaves an
+ * entry with a NULL ptr behind, which is reused by the next link.
+ */
+static struct most_c_aim_obj *get_aim_link(struct most_c_obj *c,
+					   struct most_aim *aim)
+{
+	struct most_c_aim_obj *a;
+
+	list_for_each_entry_rcu(a, &c->aim_list, list) {
+		if (a->ptr == aim)
+			return a;
+	}
+	return NULL;
+}
+
+/**
+ * lock_start_mutex - locks the start_mutex of a channel
+ * @c: pointer to channel object
+ *
+ * Waits for an asynchronous stop of the channel to finish, so that the
+ * channel is either running or stopped when this returns.
+ */
+static void lock_start_mutex(struct most_c_obj *c)
+{
+	mutex_lock(&c->start_mutex);
+	while (unlikely(c->stop_pending)) {
+		mutex_unlock(&c->start_mutex);
+		flush_work(&c->stop_work);
+		mutex_lock(&c->start_mutex);
+	}
+}
+
+/**
+ * stats_add - adds a value to a statistics counter of the channel
+ * @c: pointer to channel object
+ * @idx: counter to be increased
+ * @val: value to be added
+ *
+ * The counters are kept per CPU. Interrupts are disabled while updating,
+ * since completions may interrupt an update on the same CPU.
+ */
+static void stats_add(struct most_c_obj *c, enum most_c_stat idx, u64 val)
+{
+	struct most_c_stats *s;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	s = this_cpu_ptr(c->stats);
+	u64_stats_update_begin(&s->syncp);
+	s->cnt[idx] += val;
+	u64_stats_update_end(&s->syncp);
+	local_irq_restore(flags);
+}
+
+static void stats_xfer(struct most_c_obj *c, unsigned int bytes)
+{
+	struct most_c_stats *s;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	s = this_cpu_ptr(c->stats);
+	u64_stats_update_begin(&s->syncp);
+	s->cnt[STAT_BYTES] += bytes;
+	s->cnt[STAT_PKTS]++;
+	u64_stats_update_end(&s->syncp);
+	local_irq_restore(flags);
+}
+
+/**
+ * stats_nq_level - updates the watermarks of the HDM queue level
+ * @c: pointer to channel object
+ * @level: number of MBOs currently queued for the HDM
+ */
+static void stats_nq_level(struct most_c_obj *c, int level)
+{
+	struct most_c_stats *s;
+	unsigned long flags;
+	u64 v = level > 0 ? level : 0;
+
+	local_irq_save(flags);
+	s = this_cpu_ptr(c->stats);
+	if (v > s->cnt[STAT_NQ_HIGH] || v < s->cnt[STAT_NQ_LOW]) {
+		u64_stats_update_begin(&s->syncp);
+		if (v > s->cnt[STAT_NQ_HIGH])
+			s->cnt[STAT_NQ_HIGH] = v;
+		if (v < s->cnt[STAT_NQ_LOW])
+			s->cnt[STAT_NQ_LOW] = v;
+		u64_stats_update_end(&s->syncp);
+	}
+	local_irq_restore(flags);
+}
+
+static const char *const ch_event_name[MOST_EV_NUM] = {
+	[MOST_EV_STARVING] = "starving",
+	[MOST_EV_HALTED] = "halted",
+	[MOST_EV_RESUMED] = "resumed",
+	[MOST_EV_POISONED] = "poisoned",
+	[MOST_EV_STALL] = "stall",
+};
+
+/**
+ * channel_state_name - returns the current state of a channel
+ * @c: pointer to channel object
+ */
+static const char *channel_state_name(struct most_c_obj *c)
+{
+	const char *state = "running";
+
+	spin_lock_irq(&c->fifo_lock);
+	if (c->is_poisoned)
+		state = "poisoned";
+	else if (!READ_ONCE(c->aim_refs))
+		state = "stopped";
+	else if (c->enqueue_halt)
+		state = "halted";
+	else if (c->is_starving)
+		state = "starving";
+	spin_unlock_irq(&c->fifo_lock);
+	return state;
+}
+
+/**
+ * event_work_fn - sends the uevents of the pending channel events
+ * @work: event_work of the channel
+ *
+ * The channel is identified by the DEVPATH of the uevent, the event by
+ * the variable MOST_EVENT. Since pending events are sent in the order of
+ * their numbers, MOST_STATE tells the state of the channel at the time the
+ * uevent is sent. Once the rate limit is hit, the remaining events are
+ * sent later.
+ */
+static void event_work_fn(struct work_struct *work)
+{
+	struct most_c_obj *c = container_of(to_delayed_work(work),
+					    struct most_c_obj, event_work);
+	char env[32];
+	char state[32];
+	char *envp[] = { env, state, NULL };
+	int ev;
+
+	while ((ev = find_first_bit(&c->events, MOST_EV_NUM)) < MOST_EV_NUM) {
+		if (!__ratelimit(&c->event_rs)) {
+			schedule_delayed_work(&c->event_work,
+					      EVENT_INTERVAL / EVENT_BURST);
+			return;
+		}
+		clear_bit(ev, &c->events);
+		snprintf(env, sizeof(env), "MOST_EVENT=%s", ch_event_name[ev]);
+		snprintf(state, sizeof(state), "MOST_STATE=%s",
+			 channel_state_name(c));
+		kobject_uevent_env(&c->kobj, KOBJ_CHANGE, envp);
+	}
+}
+
+/**
+ * channel_event - schedules a uevent for a channel
+ * @c: pointer to channel object
+ * @ev: event
+ *
+ * Events of a channel are limited to EVENT_BURST per EVENT_INTERVAL, those
+ * beyond are delayed. Events that occur again before their uevent has been
+ * sent are merged.
+ */
+static void channel_event(struct most_c_obj *c, enum most_channel_event ev)
+{
+	if (!test_and_set_bit(ev, &c->events))
+		schedule_delayed_work(&c->event_work, 0);
+}
+
+static void nq_level_inc(struct most_c_obj *c)
+{
+	stats_nq_level(c, atomic_inc_return(&c->mbo_nq_level));
+}
+
+/**
+ * stats_read - sums up the statistics counters of all CPUs
+ * @c: pointer to channel object
+ * @cnt: array of STAT_NUM counters to be filled
+ */
+static void stats_read(struct most_c_obj *c, u64 *cnt)
+{
+	u64 tmp[STAT_NUM];
+	unsigned int start;
+	int cpu, i;
+
+	memset(cnt, 0, sizeof(tmp));
+	cnt[STAT_NQ_LOW] = U64_MAX;
+	for_each_possible_cpu(cpu) {
+		struct most_c_stats *s = per_cpu_ptr(c->stats, cpu);
+
+		do {
+			start = u64_stats_fetch_begin_irq(&s->syncp);
+			memcpy(tmp, s->cnt, sizeof(tmp));
+		} while (u64_stats_fetch_retry_irq(&s->syncp, start));
+
+		for (i = 0; i < STAT_NQ_HIGH; i++)
+			cnt[i] += tmp[i];
+		cnt[STAT_NQ_HIGH] = max(cnt[STAT_NQ_HIGH], tmp[STAT_NQ_HIGH]);
+		cnt[STAT_NQ_LOW] = min(cnt[STAT_NQ_LOW], tmp[STAT_NQ_LOW]);
+	}
+	if (cnt[STAT_NQ_LOW] == U64_MAX)
+		cnt[STAT_NQ_LOW] = 0;
+}
+
+static void stats_reset_cpu(struct most_c_obj *c, int cpu)
+{
+	struct most_c_stats *s = per_cpu_ptr(c->stats, cpu);
+
+	u64_stats_update_begin(&s->syncp);
+	memset(s->cnt, 0, sizeof(s->cnt));
+	s->cnt[STAT_NQ_LOW] = U64_MAX;
+	u64_stats_update_end(&s->syncp);
+	memset(per_cpu_ptr(c->hist, cpu), 0,
+	       sizeof(struct most_c_hist_buckets));
+}
+
+static void stats_reset_local(void *data)
+{
+	stats_reset_cpu(data, smp_processor_id());
+}
+
+/**
+ * stats_reset - clears the statistics counters and histograms
+ * @c: pointer to channel object
+ *
+ * The counters of a CPU are only updated by that CPU with interrupts
+ * disabled, hence each online CPU clears its own ones in an IPI.
+ */
+static void stats_reset(struct most_c_obj *c)
+{
+	int cpu;
+
+	get_online_cpus();
+	on_each_cpu(stats_reset_local, c, 1);
+	for_each_possible_cpu(cpu) {
+		if (!cpu_online(cpu))
+			stats_reset_cpu(c, cpu);
+	}
+	put_online_cpus();
+}
+
+static struct most_c_stats __percpu *stats_alloc(void)
+{
+	struct most_c_stats __percpu *stats;
+	int cpu;
+
+	stats = alloc_percpu(struct most_c_stats);
+	if (!stats)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		struct most_c_stats *s = per_cpu_ptr(stats, cpu);
+
+		u64_stats_init(&s->syncp);
+		s->cnt[STAT_NQ_LOW] = U64_MAX;
+	}
+	return stats;
+}
+
+/**
+ * hist_add - accounts a lifecycle interval of an MBO
+ * @c: pointer to channel object
+ * @idx: histogram to be updated
+ * @from: start of the interval, zero if unknown
+ * @to: end of the interval
+ *
+ * Bucket i counts intervals of 2^i to 2^(i+1) - 1 nanoseconds, the last
+ * bucket all longer ones.
+ */
+static void hist_add(struct most_c_obj *c, enum most_c_hist idx,
+		     ktime_t from, ktime_t to)
+{
+	s64 ns;
+	int bucket = 0;
+
+	if (!ktime_to_ns(from))
+		return;
+
+	ns = ktime_to_ns(ktime_sub(to, from));
+	if (ns > 1)
+		bucket = min_t(int, ilog2(ns), HIST_BUCKETS - 1);
+	this_cpu_inc(c->hist->cnt[idx][bucket]);
+}
+
+static int latency_show(struct seq_file *s, void *unused)
+{
+	struct most_c_obj *c = s->private;
+	u64 cnt[HIST_NUM][HIST_BUCKETS];
+	int cpu, h, i;
+
+	memset(cnt, 0, sizeof(cnt));
+	for_each_possible_cpu(cpu) {
+		struct most_c_hist_buckets *b = per_cpu_ptr(c->hist, cpu);
+
+		for (h = 0; h < HIST_NUM; h++)
+			for (i = 0; i < HIST_BUCKETS; i++)
+				cnt[h][i] += b->cnt[h][i];
+	}
+
+	seq_printf(s, "%-12s %12s %12s %12s\n", "ns", "queue", "hdm", "aim");
+	for (i = 0; i < HIST_BUCKETS; i++)
+		seq_printf(s, "%-12llu %12llu %12llu %12llu\n",
+			   i ? 1ULL << i : 0ULL, cnt[HIST_QUEUE][i],
+			   cnt[HIST_HDM][i], cnt[HIST_AIM][i]);
+	return 0;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, inode->i_private);
+}
+
+static const struct file_operations latency_fops = {
+	.owner = THIS_MODULE,
+	.open = latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 struct most_inst_obj {
 	int dev_id;
 	struct most_interface *iface;
@@ -89,6 +527,10 @@ struct most_inst_obj {
 	struct most_c_obj *channel[MAX_CHANNELS];
 	struct kobject kobj;
 	struct list_head list;
+	struct dentry *debugfs_dir;
+	atomic_t links_pending; /* channels not yet linked, plus one */
+	struct completion links_done;
+	struct irq_poll iop;
 };
 
 static const struct {
@@ -102,6 +544,16 @@ static const struct {
 	{ MOST_CH_ISOC, "isoc_avp\n"},
 };
 
+static const struct {
+	int policy;
+	char *name;
+} ch_sched_policy[] = {
+	{ MOST_SCHED_AUTO, "auto\n" },
+	{ SCHED_NORMAL, "normal\n" },
+	{ SCHED_FIFO, "fifo\n" },
+	{ SCHED_RR, "rr\n" },
+};
+
 #define to_inst_obj(d) container_of(d, struct most_inst_obj, kobj)
 
 /**
@@ -181,47 +633,134 @@ static const struct sysfs_ops most_channel_sysfs_ops = {
 	.store = channel_attr_store,
 };
 
+/**
+ * free_mbo - free an MBO and its buffer
+ * @c: pointer to channel object
+ * @mbo: buffer to be freed
+ * @size: size of the buffer
+ */
+static void free_mbo(struct most_c_obj *c, struct mbo *mbo, size_t size)
+{
+	void *region_end = c->region_virt + c->region_size;
+
+	if (c->iface->free_mbo_buf)
+		c->iface->free_mbo_buf(c->iface, c->channel_id, mbo, size);
+	else if (!c->region_virt || mbo->virt_address < c->region_virt ||
+		 mbo->virt_address >= region_end)
+		dma_free_coherent(NULL, size, mbo->virt_address,
+				  mbo->bus_address);
+	kmem_cache_free(mbo_cache, mbo);
+}
+
 /**
  * most_free_mbo_coherent - free an MBO and its coherent buffer
  * @mbo: buffer to be released
  *
+ * While a channel with keep_mbo set is being stopped, the MBO is parked
+ * in the pool of the channel instead.
  */
 static void most_free_mbo_coherent(struct mbo *mbo)
 {
 	struct most_c_obj *c = mbo->context;
-	size_t const coherent_buf_size = c->cfg.buffer_size + c->cfg.extra_len;
+	size_t const coherent_buf_size = c->hdm_cfg.buffer_size +
+					 c->hdm_cfg.extra_len;
+	unsigned long flags;
 
-	if (c->iface->free_mbo_buf)
-		c->iface->free_mbo_buf(c->iface, c->channel_id,
-				       mbo, coherent_buf_size);
-	else
-		dma_free_coherent(NULL, coherent_buf_size, mbo->virt_address,
-				  mbo->bus_address);
-	kfree(mbo);
+	if (c->park_mbo) {
+		spin_lock_irqsave(&c->fifo_lock, flags);
+		list_add_tail(&mbo->list, &c->mbo_pool);
+		spin_unlock_irqrestore(&c->fifo_lock, flags);
+	} else {
+		free_mbo(c, mbo, coherent_buf_size);
+	}
 	if (atomic_sub_and_test(1, &c->mbo_ref))
 		complete(&c->cleanup);
 }
 
+/**
+ * alloc_mbo_region - allocates the coherent buffers of a channel at once
+ * @c: pointer to channel object
+ * @buf_size: size of one buffer
+ *
+ * Returns the distance between two buffers within the region or 0 if
+ * the buffers need to be allocated one by one.
+ */
+static size_t alloc_mbo_region(struct most_c_obj *c, size_t buf_size)
+{
+	size_t stride = ALIGN(buf_size, dma_get_cache_alignment());
+
+	if (c->iface->alloc_mbo_buf || !c->cfg.num_buffers)
+		return 0;
+
+	c->region_size = stride * c->cfg.num_buffers;
+	c->region_virt = dma_alloc_coherent(NULL, c->region_size,
+					    &c->region_bus, GFP_KERNEL);
+	if (!c->region_virt) {
+		pr_warn("%s: No DMA coherent region (%zu bytes)\n",
+			c->iface->description, c->region_size);
+		return 0;
+	}
+	return stride;
+}
+
+/**
+ * free_mbo_region - frees the coherent buffers of a channel
+ * @c: pointer to channel object
+ *
+ * Must not be called before all MBOs of the channel have been freed.
+ */
+static void free_mbo_region(struct most_c_obj *c)
+{
+	if (!c->region_virt)
+		return;
+
+	dma_free_coherent(NULL, c->region_size, c->region_virt,
+			  c->region_bus);
+	c->region_virt = NULL;
+}
+
+/**
+ * free_mbo_pool - frees the MBOs kept while the channel is stopped
+ * @c: pointer to channel object
+ */
+static void free_mbo_pool(struct most_c_obj *c)
+{
+	size_t size = c->pool_cfg.buffer_size + c->pool_cfg.extra_len;
+	struct mbo *mbo, *tmp;
+
+	list_for_each_entry_safe(mbo, tmp, &c->mbo_pool, list) {
+		list_del(&mbo->list);
+		free_mbo(c, mbo, size);
+	}
+	free_mbo_region(c);
+}
+
+/**
+ * elastic_stop - stops growing and shrinking of the pool of a channel
+ * @c: pointer to channel object
+ */
+static void elastic_stop(struct most_c_obj *c)
+{
+	c->elastic = false;
+	cancel_work_sync(&c->grow_work);
+	cancel_delayed_work_sync(&c->shrink_work);
+	atomic_set(&c->mbo_surplus, 0);
+}
+
 /**
  * flush_channel_fifos - clear the channel fifos
  * @c: pointer to channel object
  */
 static void flush_channel_fifos(struct most_c_obj *c)
 {
-	unsigned long flags, hf_flags;
+	unsigned long hf_flags;
 	struct mbo *mbo, *tmp;
 
-	if (list_empty(&c->fifo) && list_empty(&c->halt_fifo))
+	if (__ptr_ring_empty(&c->fifo) && list_empty(&c->halt_fifo))
 		return;
 
-	spin_lock_irqsave(&c->fifo_lock, flags);
-	list_for_each_entry_safe(mbo, tmp, &c->fifo, list) {
-		list_del(&mbo->list);
-		spin_unlock_irqrestore(&c->fifo_lock, flags);
+	while ((mbo = ptr_ring_consume_any(&c->fifo)))
 		most_free_mbo_coherent(mbo);
-		spin_lock_irqsave(&c->fifo_lock, flags);
-	}
-	spin_unlock_irqrestore(&c->fifo_lock, flags);
 
 	spin_lock_irqsave(&c->fifo_lock, hf_flags);
 	list_for_each_entry_safe(mbo, tmp, &c->halt_fifo, list) {
@@ -232,7 +771,8 @@ static void flush_channel_fifos(struct most_c_obj *c)
 	}
 	spin_unlock_irqrestore(&c->fifo_lock, hf_flags);
 
-	if (unlikely((!list_empty(&c->fifo) || !list_empty(&c->halt_fifo))))
+	if (unlikely(!__ptr_ring_empty(&c->fifo) ||
+		     !list_empty(&c->halt_fifo)))
 		pr_info("WARN: fifo | trash fifo not empty\n");
 }
 
@@ -256,6 +796,14 @@ static int flush_trash_fifo(struct most_c_obj *c)
 	return 0;
 }
 
+static void trash_work_fn(struct work_struct *work)
+{
+	struct most_c_obj *c = container_of(work, struct most_c_obj,
+					    trash_work);
+
+	flush_trash_fifo(c);
+}
+
 /**
  * most_channel_release - release function of channel object
  * @kobj: pointer to channel's kobject
@@ -264,6 +812,14 @@ static void most_channel_release(struct kobject *kobj)
 {
 	struct most_c_obj *c = to_c_obj(kobj);
 
+	struct most_c_aim_obj *a, *tmp;
+
+	free_mbo_pool(c);
+	ptr_ring_cleanup(&c->fifo, NULL);
+	free_percpu(c->stats);
+	free_percpu(c->hist);
+	list_for_each_entry_safe(a, tmp, &c->aim_list, list)
+		kfree(a);
 	kfree(c);
 }
 
@@ -327,7 +883,7 @@ static ssize_t size_of_packet_buffer_show(struct most_c_obj *c,
 {
 	unsigned int i = c->channel_id;
 
-	return snprintf(buf, PAGE_SIZE, "%d\n",
+	return snprintf(buf, PAGE_SIZE, "%u\n",
 			c->iface->channel_vector[i].buffer_size_packet);
 }
 
@@ -337,7 +893,7 @@ static ssize_t size_of_stream_buffer_show(struct most_c_obj *c,
 {
 	unsigned int i = c->channel_id;
 
-	return snprintf(buf, PAGE_SIZE, "%d\n",
+	return snprintf(buf, PAGE_SIZE, "%u\n",
 			c->iface->channel_vector[i].buffer_size_streaming);
 }
 
@@ -371,7 +927,7 @@ static ssize_t set_buffer_size_show(struct most_c_obj *c,
 				    struct most_c_attr *attr,
 				    char *buf)
 {
-	return snprintf(buf, PAGE_SIZE, "%d\n", c->cfg.buffer_size);
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->cfg.buffer_size);
 }
 
 static ssize_t set_buffer_size_store(struct most_c_obj *c,
@@ -379,7 +935,7 @@ static ssize_t set_buffer_size_store(struct most_c_obj *c,
 				     const char *buf,
 				     size_t count)
 {
-	int ret = kstrtou16(buf, 0, &c->cfg.buffer_size);
+	int ret = kstrtou32(buf, 0, &c->cfg.buffer_size);
 
 	if (ret)
 		return ret;
@@ -493,7 +1049,11 @@ static ssize_t statistics_show(struct most_c_obj *c,
 			       struct most_c_attr *attr,
 			       char *buf)
 {
-	return snprintf(buf, PAGE_SIZE, "%lu %lu\n", c->stats.bytes, c->stats.pkts);
+	u64 cnt[STAT_NUM];
+
+	stats_read(c, cnt);
+	return snprintf(buf, PAGE_SIZE, "%llu %llu\n",
+			cnt[STAT_BYTES], cnt[STAT_PKTS]);
 }
 
 static ssize_t statistics_store(struct most_c_obj *c,
@@ -508,56 +1068,404 @@ static ssize_t statistics_store(struct most_c_obj *c,
 		return ret;
 	if (v != 0ul)
 		return -EFBIG;
-	c->stats.bytes = 0;
-	c->stats.pkts = 0;
+	stats_reset(c);
 	return count;
 }
 
-static struct most_c_attr most_c_attrs[] = {
-	__ATTR_RO(available_directions),
-	__ATTR_RO(available_datatypes),
-	__ATTR_RO(number_of_packet_buffers),
-	__ATTR_RO(number_of_stream_buffers),
-	__ATTR_RO(size_of_stream_buffer),
-	__ATTR_RO(size_of_packet_buffer),
-	__ATTR_RO(channel_starving),
-	__ATTR_RW(set_buffer_size),
-	__ATTR_RW(set_number_of_buffers),
-	__ATTR_RW(set_direction),
-	__ATTR_RW(set_datatype),
-	__ATTR_RW(set_subbuffer_size),
-	__ATTR_RW(set_packets_per_xact),
-	__ATTR_RW(statistics),
-};
-
-/**
- * most_channel_def_attrs - array of default attributes of channel object
- */
-static struct attribute *most_channel_def_attrs[] = {
-	&most_c_attrs[0].attr,
-	&most_c_attrs[1].attr,
-	&most_c_attrs[2].attr,
-	&most_c_attrs[3].attr,
-	&most_c_attrs[4].attr,
-	&most_c_attrs[5].attr,
-	&most_c_attrs[6].attr,
-	&most_c_attrs[7].attr,
-	&most_c_attrs[8].attr,
-	&most_c_attrs[9].attr,
-	&most_c_attrs[10].attr,
-	&most_c_attrs[11].attr,
-	&most_c_attrs[12].attr,
-	&most_c_attrs[13].attr,
-	NULL,
-};
-
-static struct kobj_type most_channel_ktype = {
-	.sysfs_ops = &most_channel_sysfs_ops,
-	.release = most_channel_release,
-	.default_attrs = most_channel_def_attrs,
-};
+static ssize_t keep_mbo_show(struct most_c_obj *c, struct most_c_attr *attr,
+			     char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", c->keep_mbo);
+}
 
-static struct kset *most_channel_kset;
+static ssize_t keep_mbo_store(struct most_c_obj *c, struct most_c_attr *attr,
+			      const char *buf, size_t count)
+{
+	int ret = kstrtobool(buf, &c->keep_mbo);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t set_min_buffers_show(struct most_c_obj *c,
+				    struct most_c_attr *attr,
+				    char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", c->min_buffers);
+}
+
+static ssize_t set_min_buffers_store(struct most_c_obj *c,
+				     struct most_c_attr *attr,
+				     const char *buf,
+				     size_t count)
+{
+	int ret = kstrtou16(buf, 0, &c->min_buffers);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t set_max_buffers_show(struct most_c_obj *c,
+				    struct most_c_attr *attr,
+				    char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", c->max_buffers);
+}
+
+static ssize_t set_max_buffers_store(struct most_c_obj *c,
+				     struct most_c_attr *attr,
+				     const char *buf,
+				     size_t count)
+{
+	int ret = kstrtou16(buf, 0, &c->max_buffers);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t set_idle_time_show(struct most_c_obj *c,
+				  struct most_c_attr *attr,
+				  char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->idle_time);
+}
+
+static ssize_t set_idle_time_store(struct most_c_obj *c,
+				   struct most_c_attr *attr,
+				   const char *buf,
+				   size_t count)
+{
+	int ret = kstrtouint(buf, 0, &c->idle_time);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t set_aim_quota_show(struct most_c_obj *c,
+				  struct most_c_attr *attr,
+				  char *buf)
+{
+	struct most_c_aim_obj *a;
+	int offs = 0;
+
+	mutex_lock(&c->start_mutex);
+	list_for_each_entry(a, &c->aim_list, list) {
+		if (!a->ptr)
+			continue;
+		offs += snprintf(buf + offs, PAGE_SIZE - offs, "%s %u %u\n",
+				 a->ptr->name, a->weight, a->min_share);
+	}
+	mutex_unlock(&c->start_mutex);
+	return offs;
+}
+
+/**
+ * set_aim_quota_store - sets the Tx buffer quota of a linked AIM
+ *
+ * Expects "aim_name:weight:min_share", e.g. "networking:3:4".
+ */
+static ssize_t set_aim_quota_store(struct most_c_obj *c,
+				   struct most_c_attr *attr,
+				   const char *buf,
+				   size_t count)
+{
+	struct most_c_aim_obj *a;
+	char name[STRING_SIZE];
+	u16 weight;
+	u16 min_share;
+	int ret = -ENODEV;
+
+	if (sscanf(buf, "%79[^:]:%hu:%hu", name, &weight, &min_share) != 3)
+		return -EINVAL;
+
+	mutex_lock(&c->start_mutex);
+	list_for_each_entry(a, &c->aim_list, list) {
+		if (a->ptr && !strcmp(a->ptr->name, name)) {
+			a->weight = weight;
+			a->min_share = min_share;
+			ret = count;
+			break;
+		}
+	}
+	mutex_unlock(&c->start_mutex);
+	return ret;
+}
+
+static ssize_t extended_statistics_show(struct most_c_obj *c,
+					struct most_c_attr *attr,
+					char *buf)
+{
+	u64 cnt[STAT_NUM];
+
+	stats_read(c, cnt);
+	return snprintf(buf, PAGE_SIZE,
+			"bytes %llu\n"
+			"packets %llu\n"
+			"e_inval %llu\n"
+			"e_close %llu\n"
+			"starved %llu\n"
+			"halted %llu\n"
+			"resumed %llu\n"
+			"nq_high %llu\n"
+			"nq_low %llu\n",
+			cnt[STAT_BYTES], cnt[STAT_PKTS], cnt[STAT_E_INVAL],
+			cnt[STAT_E_CLOSE], cnt[STAT_STARVED], cnt[STAT_HALTED],
+			cnt[STAT_RESUMED], cnt[STAT_NQ_HIGH], cnt[STAT_NQ_LOW]);
+}
+
+static ssize_t set_sched_policy_show(struct most_c_obj *c,
+				     struct most_c_attr *attr,
+				     char *buf)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ch_sched_policy); i++) {
+		if (c->sched_policy == ch_sched_policy[i].policy)
+			return snprintf(buf, PAGE_SIZE, ch_sched_policy[i].name);
+	}
+	return snprintf(buf, PAGE_SIZE, "unknown\n");
+}
+
+static ssize_t set_sched_policy_store(struct most_c_obj *c,
+				      struct most_c_attr *attr,
+				      const char *buf,
+				      size_t count)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ch_sched_policy); i++) {
+		if (!strcmp(buf, ch_sched_policy[i].name)) {
+			c->sched_policy = ch_sched_policy[i].policy;
+			return count;
+		}
+	}
+	pr_info("WARN: invalid attribute settings\n");
+	return -EINVAL;
+}
+
+static ssize_t set_sched_priority_show(struct most_c_obj *c,
+				       struct most_c_attr *attr,
+				       char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->sched_priority);
+}
+
+static ssize_t set_sched_priority_store(struct most_c_obj *c,
+					struct most_c_attr *attr,
+					const char *buf,
+					size_t count)
+{
+	unsigned int prio;
+	int ret = kstrtouint(buf, 0, &prio);
+
+	if (ret)
+		return ret;
+	if (!prio || prio >= MAX_USER_RT_PRIO)
+		return -EINVAL;
+	c->sched_priority = prio;
+	return count;
+}
+
+static ssize_t set_cpu_affinity_show(struct most_c_obj *c,
+				     struct most_c_attr *attr,
+				     char *buf)
+{
+	return cpumap_print_to_pagebuf(true, buf, &c->cpu_affinity);
+}
+
+/**
+ * update_irq_affinity - passes the CPUs used by an interface to its HDM
+ * @inst: pointer to instance object
+ *
+ * The HDM gets the union of the CPU affinities of all channels, which it
+ * may use as affinity hint of its interrupts.
+ */
+static void update_irq_affinity(struct most_inst_obj *inst)
+{
+	struct most_interface *iface = inst->iface;
+	struct most_c_obj *c;
+	cpumask_var_t mask;
+
+	if (!iface->set_irq_affinity)
+		return;
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+	list_for_each_entry(c, &inst->channel_list, list)
+		cpumask_or(mask, mask, &c->cpu_affinity);
+	iface->set_irq_affinity(iface, mask);
+	free_cpumask_var(mask);
+}
+
+static ssize_t set_cpu_affinity_store(struct most_c_obj *c,
+				      struct most_c_attr *attr,
+				      const char *buf,
+				      size_t count)
+{
+	cpumask_var_t mask;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+	ret = cpulist_parse(buf, mask);
+	if (!ret && !cpumask_intersects(mask, cpu_online_mask))
+		ret = -EINVAL;
+	if (ret) {
+		free_cpumask_var(mask);
+		return ret;
+	}
+
+	mutex_lock(&c->start_mutex);
+	cpumask_copy(&c->cpu_affinity, mask);
+	if (c->hdm_enqueue_task)
+		set_cpus_allowed_ptr(c->hdm_enqueue_task, mask);
+	mutex_unlock(&c->start_mutex);
+	free_cpumask_var(mask);
+
+	update_irq_affinity(c->inst);
+	return count;
+}
+
+static ssize_t link_time_show(struct most_c_obj *c, struct most_c_attr *attr,
+			      char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%lld\n", ktime_to_us(c->link_time));
+}
+
+static ssize_t set_coalesce_frames_show(struct most_c_obj *c,
+					struct most_c_attr *attr,
+					char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->coalesce_frames);
+}
+
+static ssize_t set_coalesce_frames_store(struct most_c_obj *c,
+					 struct most_c_attr *attr,
+					 const char *buf,
+					 size_t count)
+{
+	int ret = kstrtouint(buf, 0, &c->coalesce_frames);
+
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t set_coalesce_usecs_show(struct most_c_obj *c,
+				       struct most_c_attr *attr,
+				       char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", c->coalesce_usecs);
+}
+
+static ssize_t set_coalesce_usecs_store(struct most_c_obj *c,
+					struct most_c_attr *attr,
+					const char *buf,
+					size_t count)
+{
+	unsigned int usecs;
+	int ret = kstrtouint(buf, 0, &usecs);
+
+	if (ret)
+		return ret;
+	if (usecs > USEC_PER_SEC)
+		return -EINVAL;
+	c->coalesce_usecs = usecs;
+	return count;
+}
+
+static ssize_t reconfigure_store(struct most_c_obj *c,
+				 struct most_c_attr *attr,
+				 const char *buf,
+				 size_t count)
+{
+	bool apply;
+	int ret = kstrtobool(buf, &apply);
+
+	if (ret)
+		return ret;
+	if (apply) {
+		ret = most_reconfigure_channel(c->iface, c->channel_id);
+		if (ret)
+			return ret;
+	}
+	return count;
+}
+
+static struct most_c_attr most_c_attrs[] = {
+	__ATTR_RO(available_directions),
+	__ATTR_RO(available_datatypes),
+	__ATTR_RO(number_of_packet_buffers),
+	__ATTR_RO(number_of_stream_buffers),
+	__ATTR_RO(size_of_stream_buffer),
+	__ATTR_RO(size_of_packet_buffer),
+	__ATTR_RO(channel_starving),
+	__ATTR_RW(set_buffer_size),
+	__ATTR_RW(set_number_of_buffers),
+	__ATTR_RW(set_direction),
+	__ATTR_RW(set_datatype),
+	__ATTR_RW(set_subbuffer_size),
+	__ATTR_RW(set_packets_per_xact),
+	__ATTR_RW(statistics),
+	__ATTR_RO(extended_statistics),
+	__ATTR_RW(keep_mbo),
+	__ATTR_RW(set_min_buffers),
+	__ATTR_RW(set_max_buffers),
+	__ATTR_RW(set_idle_time),
+	__ATTR_RW(set_aim_quota),
+	__ATTR_RO(link_time),
+	__ATTR_RW(set_sched_policy),
+	__ATTR_RW(set_sched_priority),
+	__ATTR_RW(set_cpu_affinity),
+	__ATTR_RW(set_coalesce_frames),
+	__ATTR_RW(set_coalesce_usecs),
+	__ATTR_WO(reconfigure),
+};
+
+/**
+ * most_channel_def_attrs - array of default attributes of channel object
+ */
+static struct attribute *most_channel_def_attrs[] = {
+	&most_c_attrs[0].attr,
+	&most_c_attrs[1].attr,
+	&most_c_attrs[2].attr,
+	&most_c_attrs[3].attr,
+	&most_c_attrs[4].attr,
+	&most_c_attrs[5].attr,
+	&most_c_attrs[6].attr,
+	&most_c_attrs[7].attr,
+	&most_c_attrs[8].attr,
+	&most_c_attrs[9].attr,
+	&most_c_attrs[10].attr,
+	&most_c_attrs[11].attr,
+	&most_c_attrs[12].attr,
+	&most_c_attrs[13].attr,
+	&most_c_attrs[14].attr,
+	&most_c_attrs[15].attr,
+	&most_c_attrs[16].attr,
+	&most_c_attrs[17].attr,
+	&most_c_attrs[18].attr,
+	&most_c_attrs[19].attr,
+	&most_c_attrs[20].attr,
+	&most_c_attrs[21].attr,
+	&most_c_attrs[22].attr,
+	&most_c_attrs[23].attr,
+	&most_c_attrs[24].attr,
+	&most_c_attrs[25].attr,
+	&most_c_attrs[26].attr,
+	NULL,
+};
+
+static struct kobj_type most_channel_ktype = {
+	.sysfs_ops = &most_channel_sysfs_ops,
+	.release = most_channel_release,
+	.default_attrs = most_channel_def_attrs,
+};
+
+static struct kset *most_channel_kset;
 
 /**
  * create_most_c_obj - allocates a channel object
@@ -576,6 +1484,8 @@ create_most_c_obj(const char *name, struct kobject *parent)
 	c = kzalloc(sizeof(*c), GFP_KERNEL);
 	if (!c)
 		return NULL;
+	INIT_LIST_HEAD(&c->mbo_pool);
+	INIT_LIST_HEAD(&c->aim_list);
 	c->kobj.kset = most_channel_kset;
 	retval = kobject_init_and_add(&c->kobj, &most_channel_ktype, parent,
 				      "%s", name);
@@ -592,6 +1502,188 @@ create_most_c_obj(const char *name, struct kobject *parent)
  */
 
 static struct list_head instance_list = LIST_HEAD_INIT(instance_list);
+static DEFINE_MUTEX(instance_mutex); /* instance and channel lists */
+
+/**
+ * struct snapshot_buf - snapshot taken for an open snapshot file
+ * @data: header followed by the channel records
+ * @size: allocated size of data
+ * @len: valid length of data
+ * @lock: serializes the readers of the file
+ */
+struct snapshot_buf {
+	void *data;
+	size_t size;
+	size_t len;
+	struct mutex lock;
+};
+
+/**
+ * snapshot_channel - fills the snapshot record of a channel
+ * @c: pointer to channel object
+ * @r: record to be filled
+ *
+ * Queue levels and flags are sampled together under the fifo_lock.
+ */
+static void snapshot_channel(struct most_c_obj *c,
+			     struct most_snapshot_channel *r)
+{
+	struct most_c_aim_obj *a;
+	struct mbo *mbo;
+	u64 cnt[STAT_NUM];
+	int in_use = 0;
+	int free;
+
+	memset(r, 0, sizeof(*r));
+	r->dev_id = c->inst->dev_id;
+	r->channel_id = c->channel_id;
+	r->direction = c->cfg.direction;
+	r->data_type = c->cfg.data_type;
+	r->buffer_size = c->cfg.buffer_size;
+	r->num_buffers = c->cfg.num_buffers;
+	r->subbuffer_size = c->cfg.subbuffer_size;
+	r->packets_per_xact = c->cfg.packets_per_xact;
+	r->extra_len = min_t(u32, c->cfg.extra_len, U16_MAX);
+	r->extra_len32 = c->cfg.extra_len;
+	r->aims_running = c->aims_running;
+	if (c->aims_running)
+		r->flags |= MOST_SNAPSHOT_RUNNING;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(a, &c->aim_list, list)
+		in_use += atomic_read(&a->in_use);
+	rcu_read_unlock();
+
+	spin_lock_irq(&c->fifo_lock);
+	list_for_each_entry(mbo, &c->halt_fifo, list)
+		r->halt_fifo++;
+	r->mbo_ref = atomic_read(&c->mbo_ref);
+	r->nq_level = max(atomic_read(&c->mbo_nq_level), 0);
+	if (c->is_poisoned)
+		r->flags |= MOST_SNAPSHOT_POISONED;
+	if (c->enqueue_halt)
+		r->flags |= MOST_SNAPSHOT_HALTED;
+	if (c->is_starving)
+		r->flags |= MOST_SNAPSHOT_STARVING;
+	spin_unlock_irq(&c->fifo_lock);
+
+	/* Tx buffers not held by an AIM or the HDM are in the fifo */
+	free = r->mbo_ref - in_use;
+	if (c->cfg.direction == MOST_CH_TX && free > 0)
+		r->fifo = free;
+
+	stats_read(c, cnt);
+	r->bytes = cnt[STAT_BYTES];
+	r->packets = cnt[STAT_PKTS];
+	r->e_inval = cnt[STAT_E_INVAL];
+	r->e_close = cnt[STAT_E_CLOSE];
+	r->starved = cnt[STAT_STARVED];
+	r->halted = cnt[STAT_HALTED];
+	r->resumed = cnt[STAT_RESUMED];
+	r->nq_high = cnt[STAT_NQ_HIGH];
+	r->nq_low = cnt[STAT_NQ_LOW];
+}
+
+/**
+ * snapshot_take - takes a snapshot of all channels of all interfaces
+ * @sb: buffer to be filled, grown if necessary
+ */
+static int snapshot_take(struct snapshot_buf *sb)
+{
+	struct most_snapshot_channel *r;
+	struct most_snapshot_hdr *hdr;
+	struct most_inst_obj *i;
+	struct most_c_obj *c;
+	unsigned int n = 0;
+	size_t len;
+	void *data;
+	int ret = 0;
+
+	mutex_lock(&instance_mutex);
+	list_for_each_entry(i, &instance_list, list)
+		list_for_each_entry(c, &i->channel_list, list)
+			n++;
+
+	len = sizeof(*hdr) + n * sizeof(*r);
+	if (len > sb->size) {
+		data = krealloc(sb->data, len, GFP_KERNEL);
+		if (!data) {
+			ret = -ENOMEM;
+			goto unlock;
+		}
+		sb->data = data;
+		sb->size = len;
+	}
+
+	hdr = sb->data;
+	hdr->version = MOST_SNAPSHOT_VERSION;
+	hdr->record_size = sizeof(*r);
+	hdr->num_channels = n;
+	hdr->reserved = 0;
+	hdr->timestamp_ns = ktime_get_ns();
+	r = (struct most_snapshot_channel *)(hdr + 1);
+	list_for_each_entry(i, &instance_list, list)
+		list_for_each_entry(c, &i->channel_list, list)
+			snapshot_channel(c, r++);
+	sb->len = len;
+unlock:
+	mutex_unlock(&instance_mutex);
+	return ret;
+}
+
+static int snapshot_open(struct inode *inode, struct file *file)
+{
+	struct snapshot_buf *sb = kzalloc(sizeof(*sb), GFP_KERNEL);
+
+	if (!sb)
+		return -ENOMEM;
+	mutex_init(&sb->lock);
+	file->private_data = sb;
+	return 0;
+}
+
+/**
+ * snapshot_read - reads the snapshot
+ * @file: file of the snapshot
+ * @buf: user buffer
+ * @count: size of the user buffer
+ * @ppos: file position
+ *
+ * A new snapshot is taken whenever the file is read from offset 0, so a
+ * monitor keeps the file open and samples with pread().
+ */
+static ssize_t snapshot_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct snapshot_buf *sb = file->private_data;
+	ssize_t ret = 0;
+
+	mutex_lock(&sb->lock);
+	if (!*ppos)
+		ret = snapshot_take(sb);
+	if (!ret)
+		ret = simple_read_from_buffer(buf, count, ppos, sb->data,
+					      sb->len);
+	mutex_unlock(&sb->lock);
+	return ret;
+}
+
+static int snapshot_release(struct inode *inode, struct file *file)
+{
+	struct snapshot_buf *sb = file->private_data;
+
+	kfree(sb->data);
+	kfree(sb);
+	return 0;
+}
+
+static const struct file_operations snapshot_fops = {
+	.owner = THIS_MODULE,
+	.open = snapshot_open,
+	.read = snapshot_read,
+	.llseek = default_llseek,
+	.release = snapshot_release,
+};
 
 /**
  * struct most_inst_attribute - to access the attributes of instance object
@@ -771,9 +1863,16 @@ static void destroy_most_inst_obj(struct most_inst_obj *inst)
 {
 	struct most_c_obj *c, *tmp;
 
+	debugfs_remove_recursive(inst->debugfs_dir);
 	list_for_each_entry_safe(c, tmp, &inst->channel_list, list) {
+		flush_work(&c->stop_work);
+		elastic_stop(c);
+		hrtimer_cancel(&c->coalesce_timer);
+		cancel_delayed_work_sync(&c->event_work);
+		cancel_work_sync(&c->trash_work);
 		flush_trash_fifo(c);
 		flush_channel_fifos(c);
+		free_mbo_pool(c);
 		kobject_put(&c->kobj);
 	}
 	kobject_put(&inst->kobj);
@@ -786,6 +1885,7 @@ struct most_aim_obj {
 	struct kobject kobj;
 	struct list_head list;
 	struct most_aim *driver;
+	struct mutex probe_mutex; /* serializes probe_channel() */
 };
 
 #define to_aim_obj(d) container_of(d, struct most_aim_obj, kobj)
@@ -880,10 +1980,10 @@ static ssize_t links_show(struct most_aim_obj *aim_obj,
 	struct most_inst_obj *i;
 	int offs = 0;
 
+	rcu_read_lock();
 	list_for_each_entry(i, &instance_list, list) {
 		list_for_each_entry(c, &i->channel_list, list) {
-			if (c->aim0.ptr == aim_obj->driver ||
-			    c->aim1.ptr == aim_obj->driver) {
+			if (get_aim_link(c, aim_obj->driver)) {
 				offs += snprintf(buf + offs, PAGE_SIZE - offs,
 						 "%s:%s\n",
 						 kobject_name(&i->kobj),
@@ -891,6 +1991,7 @@ static ssize_t links_show(struct most_aim_obj *aim_obj,
 			}
 		}
 	}
+	rcu_read_unlock();
 
 	return offs;
 }
@@ -967,25 +2068,70 @@ most_c_obj *get_channel_by_name(char *mdev, char *mdev_ch)
 	return c;
 }
 
+/**
+ * unlink_aim - removes the link of an AIM to a channel
+ * @c: pointer to channel object
+ * @aim: AIM to be unlinked
+ *
+ * The entry stays in aim_list, since Tx MBOs of the AIM may still refer to
+ * its buffer quota.
+ */
+static void unlink_aim(struct most_c_obj *c, struct most_aim *aim)
+{
+	struct most_c_aim_obj *a;
+
+	lock_start_mutex(c);
+	a = get_aim_link(c, aim);
+	if (a)
+		a->ptr = NULL;
+	mutex_unlock(&c->start_mutex);
+}
+
 static int link_channel_to_aim(struct most_c_obj *c, struct most_aim *aim,
 			       char *aim_param)
 {
 	int ret;
-	struct most_aim **aim_ptr;
+	struct most_c_aim_obj *a;
+	struct most_aim_obj *aim_obj = aim->context;
 
-	if (!c->aim0.ptr)
-		aim_ptr = &c->aim0.ptr;
-	else if (!c->aim1.ptr)
-		aim_ptr = &c->aim1.ptr;
-	else
-		return -ENOSPC;
+	lock_start_mutex(c);
+	if (get_aim_link(c, aim)) {
+		mutex_unlock(&c->start_mutex);
+		return -EEXIST;
+	}
+	if (aim->queues_rx_mbo) {
+		list_for_each_entry(a, &c->aim_list, list) {
+			if (a->ptr && a->ptr->queues_rx_mbo) {
+				mutex_unlock(&c->start_mutex);
+				pr_info("%s: %s already queues the buffers\n",
+					c->kobj.name, a->ptr->name);
+				return -EBUSY;
+			}
+		}
+	}
+	a = get_aim_link(c, NULL);
+	if (a && a->refs)
+		a = NULL;
+	if (!a) {
+		a = kzalloc(sizeof(*a), GFP_KERNEL);
+		if (!a) {
+			mutex_unlock(&c->start_mutex);
+			return -ENOMEM;
+		}
+		list_add_tail_rcu(&a->list, &c->aim_list);
+	}
+	a->ptr = aim;
+	a->weight = 1;
+	a->min_share = 0;
+	mutex_unlock(&c->start_mutex);
 
 	pr_debug("probing %s %s (%s)\n", aim->name, aim_param, c->kobj.name);
-	*aim_ptr = aim;
+	mutex_lock(&aim_obj->probe_mutex);
 	ret = aim->probe_channel(c->iface, c->channel_id,
 				 &c->cfg, &c->kobj, aim_param);
+	mutex_unlock(&aim_obj->probe_mutex);
 	if (ret) {
-		*aim_ptr = NULL;
+		unlink_aim(c, aim);
 		return ret;
 	}
 
@@ -1084,10 +2230,7 @@ static ssize_t remove_link_store(struct most_aim_obj *aim_obj,
 
 	if (aim_obj->driver->disconnect_channel(c->iface, c->channel_id))
 		return -EIO;
-	if (c->aim0.ptr == aim_obj->driver)
-		c->aim0.ptr = NULL;
-	if (c->aim1.ptr == aim_obj->driver)
-		c->aim1.ptr = NULL;
+	unlink_aim(c, aim_obj->driver);
 	return len;
 }
 
@@ -1128,6 +2271,7 @@ static struct most_aim_obj *create_most_aim_obj(const char *name)
 	most_aim = kzalloc(sizeof(*most_aim), GFP_KERNEL);
 	if (!most_aim)
 		return NULL;
+	mutex_init(&most_aim->probe_mutex);
 	most_aim->kobj.kset = most_aim_kset;
 	retval = kobject_init_and_add(&most_aim->kobj, &most_aim_ktype,
 				      NULL, "%s", name);
@@ -1170,14 +2314,23 @@ static struct device_driver mostcore = {
 	.bus = &most_bus,
 };
 
+/**
+ * trash_mbo - schedules an MBO to be freed
+ * @mbo: buffer object
+ *
+ * MBOs may return in atomic context, hence they are freed by the
+ * trash_work of the channel.
+ */
 static inline void trash_mbo(struct mbo *mbo)
 {
 	unsigned long flags;
 	struct most_c_obj *c = mbo->context;
 
+	trace_most_trash_mbo(c->inst->dev_id, mbo);
 	spin_lock_irqsave(&c->fifo_lock, flags);
 	list_add(&mbo->list, &c->trash_fifo);
 	spin_unlock_irqrestore(&c->fifo_lock, flags);
+	schedule_work(&c->trash_work);
 }
 
 static bool hdm_mbo_ready(struct most_c_obj *c)
@@ -1188,29 +2341,120 @@ static bool hdm_mbo_ready(struct most_c_obj *c)
 		return false;
 
 	spin_lock_irq(&c->fifo_lock);
-	empty = list_empty(&c->halt_fifo);
+	empty = list_empty(&c->halt_fifo) || c->nq_busy;
 	spin_unlock_irq(&c->fifo_lock);
 
 	return !empty;
 }
 
+/**
+ * prepare_nq - prepares an MBO right before it is handed to the HDM
+ * @c: pointer to channel object
+ * @mbo: buffer object
+ */
+static void prepare_nq(struct most_c_obj *c, struct mbo *mbo)
+{
+	if (c->hdm_cfg.direction == MOST_CH_RX)
+		mbo->buffer_length = c->hdm_cfg.buffer_size;
+	mbo->hw_ts = ktime_set(0, 0);
+	mbo->ts_enqueue = ktime_get();
+	hist_add(c, HIST_QUEUE, mbo->ts_submit, mbo->ts_enqueue);
+	trace_most_hdm_enqueue(c->inst->dev_id, mbo);
+}
+
+/**
+ * hdm_direct_nq - hands an MBO to the HDM in the current context
+ * @c: pointer to channel object
+ * @mbo: buffer object
+ *
+ * This is done only if the channel is neither halted nor poisoned and no
+ * other MBO is waiting in or taken from the halt fifo, which keeps the
+ * order of the MBOs. If the HDM refuses the MBO, it is put back to the
+ * head of the halt fifo and left to the enqueue thread.
+ *
+ * Returns true if the MBO has been taken care of.
+ */
+static bool hdm_direct_nq(struct most_c_obj *c, struct mbo *mbo)
+{
+	unsigned long flags;
+	bool wake;
+	int ret;
+
+	spin_lock_irqsave(&c->fifo_lock, flags);
+	if (c->enqueue_halt || c->is_poisoned || c->nq_busy ||
+	    !list_empty(&c->halt_fifo)) {
+		spin_unlock_irqrestore(&c->fifo_lock, flags);
+		return false;
+	}
+	c->nq_busy = true;
+	spin_unlock_irqrestore(&c->fifo_lock, flags);
+
+	prepare_nq(c, mbo);
+	ret = c->iface->enqueue(c->iface, c->channel_id, mbo);
+
+	spin_lock_irqsave(&c->fifo_lock, flags);
+	if (unlikely(ret))
+		list_add(&mbo->list, &c->halt_fifo);
+	c->nq_busy = false;
+	wake = ret || c->enqueue_halt || c->is_poisoned ||
+	       !list_empty(&c->halt_fifo);
+	spin_unlock_irqrestore(&c->fifo_lock, flags);
+
+	if (wake)
+		wake_up(&c->hdm_fifo_wq);
+	return true;
+}
+
+/**
+ * wait_for_direct_nq - waits until a running direct enqueue is finished
+ * @c: pointer to channel object
+ *
+ * The caller must have set enqueue_halt or is_poisoned beforehand to
+ * prevent further direct enqueues.
+ */
+static void wait_for_direct_nq(struct most_c_obj *c)
+{
+	wait_event(c->hdm_fifo_wq, !c->nq_busy);
+}
+
 static void nq_hdm_mbo(struct mbo *mbo)
 {
 	unsigned long flags;
 	struct most_c_obj *c = mbo->context;
 
+	trace_most_nq_hdm_mbo(c->inst->dev_id, mbo);
+	if (c->iface->enqueue_atomic && hdm_direct_nq(c, mbo))
+		return;
+
 	spin_lock_irqsave(&c->fifo_lock, flags);
+	if (unlikely(c->is_poisoned)) {
+		/* returned by an AIM after the halt fifo has been flushed */
+		spin_unlock_irqrestore(&c->fifo_lock, flags);
+		trash_mbo(mbo);
+		return;
+	}
 	list_add_tail(&mbo->list, &c->halt_fifo);
 	spin_unlock_irqrestore(&c->fifo_lock, flags);
 	wake_up_interruptible(&c->hdm_fifo_wq);
 }
 
+/**
+ * hdm_enqueue_thread - hands the MBOs of the halt fifo to the HDM
+ * @data: pointer to channel object
+ *
+ * If the HDM refuses an MBO, e.g. because it ran out of memory for a
+ * moment, the MBOs are kept in the halt fifo and the enqueue is tried
+ * again after a delay that doubles with each failure.
+ */
 static int hdm_enqueue_thread(void *data)
 {
 	struct most_c_obj *c = data;
 	struct mbo *mbo;
+	LIST_HEAD(batch);
+	unsigned long retry = NQ_RETRY_MIN;
 	int ret;
 	typeof(c->iface->enqueue) enqueue = c->iface->enqueue;
+	typeof(c->iface->enqueue_batch) enqueue_batch = c->iface->enqueue_batch;
 
 	while (likely(!kthread_should_stop())) {
 		wait_event_interruptible(c->hdm_fifo_wq,
@@ -1219,32 +2463,77 @@ static int hdm_enqueue_thread(void *data)
 
 		mutex_lock(&c->nq_mutex);
 		spin_lock_irq(&c->fifo_lock);
-		if (unlikely(c->enqueue_halt || list_empty(&c->halt_fifo))) {
+		if (unlikely(c->enqueue_halt || c->nq_busy ||
+			     list_empty(&c->halt_fifo))) {
 			spin_unlock_irq(&c->fifo_lock);
 			mutex_unlock(&c->nq_mutex);
 			continue;
 		}
 
-		mbo = list_pop_mbo(&c->halt_fifo);
+		if (enqueue_batch)
+			list_splice_init(&c->halt_fifo, &batch);
+		else
+			list_move_tail(c->halt_fifo.next, &batch);
+		c->nq_busy = true;
 		spin_unlock_irq(&c->fifo_lock);
 
-		if (c->cfg.direction == MOST_CH_RX)
-			mbo->buffer_length = c->cfg.buffer_size;
+		list_for_each_entry(mbo, &batch, list)
+			prepare_nq(c, mbo);
 
-		ret = enqueue(mbo->ifp, mbo->hdm_channel_id, mbo);
+		if (enqueue_batch) {
+			ret = enqueue_batch(c->iface, c->channel_id, &batch);
+		} else {
+			mbo = list_pop_mbo(&batch);
+			ret = enqueue(mbo->ifp, mbo->hdm_channel_id, mbo);
+			if (unlikely(ret))
+				list_add(&mbo->list, &batch);
+		}
+
+		/* MBOs the HDM did not take go back to the head of the fifo */
+		spin_lock_irq(&c->fifo_lock);
+		list_splice_init(&batch, &c->halt_fifo);
+		c->nq_busy = false;
+		spin_unlock_irq(&c->fifo_lock);
 		mutex_unlock(&c->nq_mutex);
 
-		if (unlikely(ret)) {
-			pr_err("hdm enqueue failed\n");
-			nq_hdm_mbo(mbo);
-			c->hdm_enqueue_task = NULL;
-			return 0;
+		if (likely(!ret)) {
+			retry = NQ_RETRY_MIN;
+			continue;
 		}
+		pr_err_ratelimited("hdm enqueue failed (%d), retrying\n", ret);
+		wait_event_interruptible_timeout(c->hdm_fifo_wq,
+						 kthread_should_stop(), retry);
+		retry = min_t(unsigned long, retry * 2, NQ_RETRY_MAX);
 	}
 
 	return 0;
 }
 
+/**
+ * sched_thread - applies the scheduling settings of a channel to a thread
+ * @c: pointer to channel object
+ * @task: thread serving the channel
+ *
+ * With policy auto, threads of synchronous and isochronous channels run
+ * as SCHED_FIFO, all others as SCHED_NORMAL. The thread is bound to the
+ * CPUs of the channel.
+ */
+static void sched_thread(struct most_c_obj *c, struct task_struct *task)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	int policy = c->sched_policy;
+
+	if (policy == MOST_SCHED_AUTO)
+		policy = c->cfg.data_type & (MOST_CH_SYNC | MOST_CH_ISOC) ?
+			 SCHED_FIFO : SCHED_NORMAL;
+	if (policy != SCHED_NORMAL)
+		param.sched_priority = c->sched_priority;
+	if (sched_setscheduler_nocheck(task, policy, &param))
+		pr_warn("failed to set scheduling policy of %s\n", task->comm);
+	if (set_cpus_allowed_ptr(task, &c->cpu_affinity))
+		pr_warn("failed to set CPU affinity of %s\n", task->comm);
+}
+
 static int run_enqueue_thread(struct most_c_obj *c, int channel_id)
 {
 	struct task_struct *task =
@@ -1254,15 +2543,101 @@ static int run_enqueue_thread(struct most_c_obj *c, int channel_id)
 	if (IS_ERR(task))
 		return PTR_ERR(task);
 
-	c->hdm_enqueue_task = task;
-	return 0;
+	sched_thread(c, task);
+	c->hdm_enqueue_task = task;
+	return 0;
+}
+
+/**
+ * notify_tx_aims - calls the Tx completion handlers of the linked AIMs
+ * @c: pointer to channel object
+ */
+static void notify_tx_aims(struct most_c_obj *c)
+{
+	struct most_c_aim_obj *a;
+	struct most_aim *aim;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(a, &c->aim_list, list) {
+		aim = a->ptr;
+		if (a->refs && aim && aim->tx_completion)
+			aim->tx_completion(c->iface, c->channel_id);
+	}
+	rcu_read_unlock();
+}
+
+static enum hrtimer_restart coalesce_timer_fn(struct hrtimer *timer)
+{
+	struct most_c_obj *c = container_of(timer, struct most_c_obj,
+					    coalesce_timer);
+
+	atomic_set(&c->tx_pending, 0);
+	notify_tx_aims(c);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * tx_notify - tells the AIMs about recycled Tx buffers
+ * @c: pointer to channel object
+ * @n: number of buffers that went back to the ring
+ *
+ * With coalescing configured, the AIMs are called once coalesce_frames
+ * buffers have been recycled or coalesce_usecs after the first of them,
+ * whichever comes first.
+ */
+static void tx_notify(struct most_c_obj *c, int n)
+{
+	if (c->coalesce_frames > 1 && c->coalesce_usecs) {
+		if (atomic_add_return(n, &c->tx_pending) < c->coalesce_frames) {
+			if (!hrtimer_active(&c->coalesce_timer))
+				hrtimer_start(&c->coalesce_timer,
+					      ns_to_ktime((u64)c->coalesce_usecs *
+							  NSEC_PER_USEC),
+					      HRTIMER_MODE_REL);
+			return;
+		}
+		hrtimer_try_to_cancel(&c->coalesce_timer);
+		atomic_set(&c->tx_pending, 0);
+	}
+	notify_tx_aims(c);
+}
+
+/**
+ * __arm_mbo - put MBO back to the ring without notifying the AIMs
+ * @mbo: buffer object
+ *
+ * Returns true if the MBO is ready for further usage and false if it
+ * has been trashed.
+ */
+static bool __arm_mbo(struct mbo *mbo)
+{
+	struct most_c_obj *c;
+
+	BUG_ON((!mbo) || (!mbo->context));
+	c = mbo->context;
+
+	if (c->is_poisoned || atomic_add_unless(&c->mbo_surplus, -1, 0)) {
+		trash_mbo(mbo);
+		return false;
+	}
+
+	trace_most_arm_mbo(c->inst->dev_id, mbo);
+	stats_xfer(c, mbo->buffer_length);
+	atomic_dec(mbo->num_buffers_ptr);
+	if (unlikely(ptr_ring_produce_any(&c->fifo, mbo))) {
+		/* the ring has room for all MBOs, this is a bug */
+		pr_err("fifo of ch %d overrun\n", c->channel_id);
+		trash_mbo(mbo);
+		return false;
+	}
+	return true;
 }
 
 /**
  * arm_mbo - recycle MBO for further usage
  * @mbo: buffer object
  *
- * This puts an MBO back to the list to have it ready for up coming
+ * This puts an MBO back to the ring to have it ready for up coming
  * tx transactions.
  *
  * In case the MBO belongs to a channel that recently has been
@@ -1271,29 +2646,94 @@ static int run_enqueue_thread(struct most_c_obj *c, int channel_id)
  */
 static void arm_mbo(struct mbo *mbo)
 {
-	unsigned long flags;
-	struct most_c_obj *c;
+	if (__arm_mbo(mbo))
+		tx_notify(mbo->context, 1);
+}
 
-	BUG_ON((!mbo) || (!mbo->context));
-	c = mbo->context;
+/**
+ * arm_mbo_pool - helper function that re-arms the kept MBOs for the HDM
+ * @c: pointer to interface channel
+ * @dir: direction of the channel
+ * @compl: pointer to completion function
+ *
+ * Returns the number of enqueued MBOs.
+ */
+static int arm_mbo_pool(struct most_c_obj *c, int dir,
+			void (*compl)(struct mbo *))
+{
+	struct mbo *mbo, *tmp;
+	LIST_HEAD(pool);
+	int i = 0;
 
-	if (c->is_poisoned) {
-		trash_mbo(mbo);
-		return;
+	atomic_set(&c->mbo_nq_level, 0);
+	list_splice_init(&c->mbo_pool, &pool);
+
+	list_for_each_entry_safe(mbo, tmp, &pool, list) {
+		list_del(&mbo->list);
+		if (i >= c->elastic_max) {
+			free_mbo(c, mbo, c->pool_cfg.buffer_size +
+				 c->pool_cfg.extra_len);
+			continue;
+		}
+		mbo->buffer_length = 0;
+		mbo->processed_length = 0;
+		mbo->status = MBO_SUCCESS;
+		mbo->complete = compl;
+		mbo->num_buffers_ptr = &dummy_num_buffers;
+		mbo->ts_get = ktime_set(0, 0);
+		mbo->ts_enqueue = ktime_set(0, 0);
+		mbo->ts_complete = ktime_set(0, 0);
+		mbo->ts_release = ktime_set(0, 0);
+		atomic_inc(&c->mbo_ref);
+		if (dir == MOST_CH_RX) {
+			mbo->ts_submit = ktime_get();
+			nq_level_inc(c);
+			nq_hdm_mbo(mbo);
+		} else {
+			mbo->ts_submit = ktime_set(0, 0);
+			arm_mbo(mbo);
+		}
+		i++;
 	}
+	return i;
+}
 
-	c->stats.pkts++;
-	c->stats.bytes += mbo->buffer_length;
-	spin_lock_irqsave(&c->fifo_lock, flags);
-	++*mbo->num_buffers_ptr;
-	list_add_tail(&mbo->list, &c->fifo);
-	spin_unlock_irqrestore(&c->fifo_lock, flags);
+/**
+ * alloc_mbo - allocates an MBO including its own DMA coherent buffer
+ * @c: pointer to interface channel
+ * @size: size of the buffer
+ *
+ * Returns a pointer to the MBO or NULL.
+ */
+static struct mbo *alloc_mbo(struct most_c_obj *c, size_t size)
+{
+	struct mbo *mbo = kmem_cache_zalloc(mbo_cache, GFP_KERNEL);
+
+	if (!mbo)
+		return NULL;
 
-	if (c->aim0.refs && c->aim0.ptr->tx_completion)
-		c->aim0.ptr->tx_completion(c->iface, c->channel_id);
+	mbo->context = c;
+	mbo->ifp = c->iface;
+	mbo->hdm_channel_id = c->channel_id;
+	if (c->iface->alloc_mbo_buf) {
+		if (c->iface->alloc_mbo_buf(c->iface, c->channel_id, mbo,
+					    size))
+			goto err_free;
+	} else {
+		mbo->virt_address = dma_alloc_coherent(NULL, size,
+						       &mbo->bus_address,
+						       GFP_KERNEL);
+		if (!mbo->virt_address) {
+			pr_warn("%s: No DMA coherent buffer (%zu bytes)\n",
+				c->iface->description, size);
+			goto err_free;
+		}
+	}
+	return mbo;
 
-	if (c->aim1.refs && c->aim1.ptr->tx_completion)
-		c->aim1.ptr->tx_completion(c->iface, c->channel_id);
+err_free:
+	kmem_cache_free(mbo_cache, mbo);
+	return NULL;
 }
 
 /**
@@ -1303,7 +2743,9 @@ static void arm_mbo(struct mbo *mbo)
  * @compl: pointer to completion function
  *
  * This allocates buffer objects including the containing DMA coherent
- * buffer and puts them in the fifo.
+ * buffer and puts them in the fifo. Unless the HDM allocates the buffers
+ * itself, they are carved out of a single coherent region of the channel.
+ * MBOs kept from the previous run of the channel are used instead, if any.
  * Buffers of Rx channels are put in the kthread fifo, hence immediately
  * submitted to the HDM.
  *
@@ -1313,53 +2755,46 @@ static int arm_mbo_chain(struct most_c_obj *c, int dir,
 			 void (*compl)(struct mbo *))
 {
 	unsigned int i;
-	int retval;
 	struct mbo *mbo;
-	size_t coherent_buf_size = c->cfg.buffer_size + c->cfg.extra_len;
+	size_t coherent_buf_size = c->hdm_cfg.buffer_size +
+				   c->hdm_cfg.extra_len;
+	size_t stride;
 
+	if (!list_empty(&c->mbo_pool))
+		return arm_mbo_pool(c, dir, compl);
+
+	stride = alloc_mbo_region(c, coherent_buf_size);
 	atomic_set(&c->mbo_nq_level, 0);
 
 	for (i = 0; i < c->cfg.num_buffers; i++) {
-		mbo = kzalloc(sizeof(*mbo), GFP_KERNEL);
-		if (!mbo) {
-			retval = i;
-			goto _exit;
-		}
-		mbo->context = c;
-		mbo->ifp = c->iface;
-		mbo->hdm_channel_id = c->channel_id;
-		if (c->iface->alloc_mbo_buf) {
-			retval = c->iface->alloc_mbo_buf(c->iface, c->channel_id,
-							 mbo, coherent_buf_size);
-			if (retval)
-				goto _error1;
+		if (stride) {
+			mbo = kmem_cache_zalloc(mbo_cache, GFP_KERNEL);
+			if (!mbo)
+				break;
+			mbo->context = c;
+			mbo->ifp = c->iface;
+			mbo->hdm_channel_id = c->channel_id;
+			mbo->virt_address = c->region_virt + i * stride;
+			mbo->bus_address = c->region_bus + i * stride;
 		} else {
-			mbo->virt_address = dma_alloc_coherent(NULL,
-							       coherent_buf_size,
-							       &mbo->bus_address,
-							       GFP_KERNEL);
-			if (!mbo->virt_address) {
-				pr_warn("%s: No DMA coherent buffer (%zu bytes)\n",
-					c->iface->description, coherent_buf_size);
-				retval = i;
-				goto _error1;
-			}
+			mbo = alloc_mbo(c, coherent_buf_size);
+			if (!mbo)
+				break;
 		}
 		mbo->complete = compl;
 		mbo->num_buffers_ptr = &dummy_num_buffers;
+		atomic_inc(&c->mbo_ref);
 		if (dir == MOST_CH_RX) {
+			mbo->ts_submit = ktime_get();
+			nq_level_inc(c);
 			nq_hdm_mbo(mbo);
-			atomic_inc(&c->mbo_nq_level);
 		} else {
 			arm_mbo(mbo);
 		}
 	}
+	if (!i)
+		free_mbo_region(c);
 	return i;
-
-_error1:
-	kfree(mbo);
-_exit:
-	return retval;
 }
 
 /**
@@ -1368,34 +2803,79 @@ _exit:
  */
 void most_submit_mbo(struct mbo *mbo)
 {
+	struct most_c_obj *c;
+
 	if (WARN_ONCE(!mbo || !mbo->context,
 		      "bad mbo or missing channel reference\n"))
 		return;
 
+	c = mbo->context;
+	trace_most_submit_mbo(c->inst->dev_id, mbo);
+	mbo->ts_submit = ktime_get();
+	hist_add(c, HIST_AIM, mbo->ts_get, mbo->ts_submit);
+	nq_level_inc(c);
 	nq_hdm_mbo(mbo);
 }
 EXPORT_SYMBOL_GPL(most_submit_mbo);
 
 /**
- * most_write_completion - write completion handler
+ * stamp_mbo - numbers a completed MBO
+ * @c: pointer to channel object
+ * @mbo: buffer object
+ *
+ * This also sets the completion time of the MBO, unless the HDM has
+ * already done so.
+ */
+static void stamp_mbo(struct most_c_obj *c, struct mbo *mbo)
+{
+	mbo->seq = atomic_inc_return(&c->seq) - 1;
+	if (!ktime_to_ns(mbo->hw_ts))
+		mbo->hw_ts = mbo->ts_complete;
+}
+
+/**
+ * write_completion - recycles a transmitted MBO
  * @mbo: pointer to MBO
  *
- * This recycles the MBO for further usage. In case the channel has been
- * poisoned, the MBO is scheduled to be trashed.
+ * Returns true if the MBO went back to the ring and the AIMs are still
+ * to be notified.
  */
-static void most_write_completion(struct mbo *mbo)
+static bool write_completion(struct mbo *mbo)
 {
 	struct most_c_obj *c;
 
 	BUG_ON((!mbo) || (!mbo->context));
 
 	c = mbo->context;
-	if (mbo->status == MBO_E_INVAL)
-		pr_info("WARN: Tx MBO status: invalid\n");
-	if (unlikely(c->is_poisoned || (mbo->status == MBO_E_CLOSE)))
+	trace_most_write_completion(c->inst->dev_id, mbo);
+	mbo->ts_complete = ktime_get();
+	hist_add(c, HIST_HDM, mbo->ts_enqueue, mbo->ts_complete);
+	stats_nq_level(c, atomic_dec_return(&c->mbo_nq_level));
+	if (mbo->status == MBO_E_INVAL) {
+		stats_add(c, STAT_E_INVAL, 1);
+		pr_info_ratelimited("WARN: Tx MBO status: invalid\n");
+	}
+	if (mbo->status == MBO_E_CLOSE)
+		stats_add(c, STAT_E_CLOSE, 1);
+	if (unlikely(c->is_poisoned || (mbo->status == MBO_E_CLOSE))) {
 		trash_mbo(mbo);
-	else
-		arm_mbo(mbo);
+		return false;
+	}
+	stamp_mbo(c, mbo);
+	return __arm_mbo(mbo);
+}
+
+/**
+ * most_write_completion - write completion handler
+ * @mbo: pointer to MBO
+ *
+ * This recycles the MBO for further usage. In case the channel has been
+ * poisoned, the MBO is scheduled to be trashed.
+ */
+static void most_write_completion(struct mbo *mbo)
+{
+	if (write_completion(mbo))
+		tx_notify(mbo->context, 1);
 }
 
 /**
@@ -1426,24 +2906,133 @@ most_c_obj *get_channel_by_iface(struct most_interface *iface, int id)
 	return i->channel[id];
 }
 
+/**
+ * most_sched_thread - applies the scheduling settings of a channel
+ * @iface: pointer to interface instance
+ * @id: channel ID
+ * @task: thread of the AIM serving the channel
+ *
+ * AIMs call this for threads that move the data of a channel, so that
+ * they run with the policy, priority and CPU affinity configured for it.
+ */
+void most_sched_thread(struct most_interface *iface, int id,
+		       struct task_struct *task)
+{
+	struct most_c_obj *c = get_channel_by_iface(iface, id);
+
+	if (unlikely(!c))
+		return;
+	sched_thread(c, task);
+}
+EXPORT_SYMBOL_GPL(most_sched_thread);
+
+/**
+ * most_complete_batch - completes a list of buffers of one channel
+ * @iface: pointer to interface instance
+ * @id: channel ID
+ * @done: list of completed MBOs, linked by their list member
+ *
+ * HDMs that collect completed buffers use this instead of calling the
+ * complete() handler of each MBO. Received buffers are handed to the AIMs
+ * one by one, whereas the AIMs of a Tx channel are notified only once for
+ * the whole batch. The list is empty on return.
+ */
+void most_complete_batch(struct most_interface *iface, int id,
+			 struct list_head *done)
+{
+	struct most_c_obj *c = get_channel_by_iface(iface, id);
+	struct mbo *mbo, *tmp;
+	int n = 0;
+
+	if (unlikely(!c))
+		return;
+
+	list_for_each_entry_safe(mbo, tmp, done, list) {
+		list_del(&mbo->list);
+		if (c->cfg.direction == MOST_CH_RX)
+			mbo->complete(mbo);
+		else if (write_completion(mbo))
+			n++;
+	}
+	if (n)
+		tx_notify(c, n);
+}
+EXPORT_SYMBOL_GPL(most_complete_batch);
+
+/**
+ * aim_share - returns the number of Tx buffers an AIM is entitled to
+ * @a: link of the AIM
+ * @total: number of buffers of the channel
+ * @weights: sum of the weights of all AIMs that started the channel
+ */
+static int aim_share(struct most_c_aim_obj *a, int total, int weights)
+{
+	return max_t(int, a->min_share, total * a->weight / weights);
+}
+
+/**
+ * may_get_mbo - checks the Tx buffer quota of an AIM
+ * @c: pointer to channel object
+ * @a: link of the AIM or NULL
+ *
+ * While more than one AIM uses the channel, each of them is entitled to a
+ * share of the buffers according to its weight, but at least to its
+ * minimum share. An AIM within its share may take any free buffer. Beyond
+ * it, the AIM borrows a buffer only if enough free buffers are left for
+ * the others to reach their shares. Hence, idle quota is not wasted.
+ *
+ * Must be called under rcu_read_lock().
+ */
+static bool may_get_mbo(struct most_c_obj *c, struct most_c_aim_obj *a)
+{
+	struct most_c_aim_obj *b;
+	int total = atomic_read(&c->mbo_ref);
+	int weights = 0;
+	int reserved = 0;
+	int free = total;
+	int used;
+
+	if (!a || !a->refs || c->aims_running < 2)
+		return true;
+
+	list_for_each_entry_rcu(b, &c->aim_list, list) {
+		if (b->refs && b->ptr)
+			weights += b->weight;
+	}
+	if (!weights)
+		return true;
+
+	if (atomic_read(&a->in_use) < aim_share(a, total, weights))
+		return true;
+
+	list_for_each_entry_rcu(b, &c->aim_list, list) {
+		used = atomic_read(&b->in_use);
+		free -= used;
+		if (b != a && b->refs && b->ptr)
+			reserved += max(aim_share(b, total, weights) - used, 0);
+	}
+	return free > reserved;
+}
+
 int channel_has_mbo(struct most_interface *iface, int id, struct most_aim *aim)
 {
 	struct most_c_obj *c = get_channel_by_iface(iface, id);
-	unsigned long flags;
-	int empty;
+
+	struct most_c_aim_obj *a;
 
 	if (unlikely(!c))
 		return -EINVAL;
 
-	if (c->aim0.refs && c->aim1.refs &&
-	    ((aim == c->aim0.ptr && c->aim0.num_buffers <= 0) ||
-	     (aim == c->aim1.ptr && c->aim1.num_buffers <= 0)))
+	rcu_read_lock();
+	a = get_aim_link(c, aim);
+	if (!may_get_mbo(c, a)) {
+		rcu_read_unlock();
 		return 0;
+	}
+	rcu_read_unlock();
 
-	spin_lock_irqsave(&c->fifo_lock, flags);
-	empty = list_empty(&c->fifo);
-	spin_unlock_irqrestore(&c->fifo_lock, flags);
-	return !empty;
+	/* resize_pool() may swap the ring of a running channel */
+	return !ptr_ring_empty_any(&c->fifo);
 }
 EXPORT_SYMBOL_GPL(channel_has_mbo);
 
@@ -1452,7 +3041,9 @@ EXPORT_SYMBOL_GPL(channel_has_mbo);
  * @iface: pointer to interface instance
  * @id: channel ID
  *
- * This attempts to get a free buffer out of the channel fifo.
+ * This attempts to get a free buffer out of the channel fifo. The fifo is
+ * a ring with separate producer and consumer locks, hence this does not
+ * contend with arm_mbo() running in the completion context of the HDM.
  * Returns a pointer to MBO on success or NULL otherwise.
  */
 struct mbo *most_get_mbo(struct most_interface *iface, int id,
@@ -1460,36 +3051,35 @@ struct mbo *most_get_mbo(struct most_interface *iface, int id,
 {
 	struct mbo *mbo;
 	struct most_c_obj *c;
-	unsigned long flags;
-	int *num_buffers_ptr;
+	struct most_c_aim_obj *a;
+	atomic_t *num_buffers_ptr;
 
 	c = get_channel_by_iface(iface, id);
 	if (unlikely(!c))
 		return NULL;
 
-	if (c->aim0.refs && c->aim1.refs &&
-	    ((aim == c->aim0.ptr && c->aim0.num_buffers <= 0) ||
-	     (aim == c->aim1.ptr && c->aim1.num_buffers <= 0)))
+	rcu_read_lock();
+	a = get_aim_link(c, aim);
+	if (!may_get_mbo(c, a)) {
+		rcu_read_unlock();
 		return NULL;
+	}
+	rcu_read_unlock();
 
-	if (aim == c->aim0.ptr)
-		num_buffers_ptr = &c->aim0.num_buffers;
-	else if (aim == c->aim1.ptr)
-		num_buffers_ptr = &c->aim1.num_buffers;
-	else
-		num_buffers_ptr = &dummy_num_buffers;
+	num_buffers_ptr = a ? &a->in_use : &dummy_num_buffers;
 
-	spin_lock_irqsave(&c->fifo_lock, flags);
-	if (list_empty(&c->fifo)) {
-		spin_unlock_irqrestore(&c->fifo_lock, flags);
+	mbo = ptr_ring_consume_any(&c->fifo);
+	if (!mbo) {
+		if (c->elastic)
+			schedule_work(&c->grow_work);
 		return NULL;
 	}
-	mbo = list_pop_mbo(&c->fifo);
-	--*num_buffers_ptr;
-	spin_unlock_irqrestore(&c->fifo_lock, flags);
+	atomic_inc(num_buffers_ptr);
 
 	mbo->num_buffers_ptr = num_buffers_ptr;
-	mbo->buffer_length = c->cfg.buffer_size;
+	mbo->buffer_length = c->hdm_cfg.buffer_size;
+	mbo->ts_get = ktime_get();
+	trace_most_get_mbo(c->inst->dev_id, mbo);
 	return mbo;
 }
 EXPORT_SYMBOL_GPL(most_get_mbo);
@@ -1497,17 +3087,31 @@ EXPORT_SYMBOL_GPL(most_get_mbo);
 /**
  * most_put_mbo - return buffer to pool
  * @mbo: buffer object
+ *
+ * A received buffer is shared by all AIMs that accepted it and goes back
+ * to the HDM when the last of them has put it.
  */
 void most_put_mbo(struct mbo *mbo)
 {
 	struct most_c_obj *c = mbo->context;
 
+	trace_most_put_mbo(c->inst->dev_id, mbo);
+	mbo->ts_release = ktime_get();
 	if (c->cfg.direction == MOST_CH_TX) {
+		hist_add(c, HIST_AIM, mbo->ts_get, mbo->ts_release);
 		arm_mbo(mbo);
 		return;
 	}
+	if (!atomic_dec_and_test(&mbo->refs))
+		return;
+	hist_add(c, HIST_AIM, mbo->ts_complete, mbo->ts_release);
+	if (atomic_add_unless(&c->mbo_surplus, -1, 0)) {
+		trash_mbo(mbo);
+		return;
+	}
+	mbo->ts_submit = mbo->ts_release;
+	nq_level_inc(c);
 	nq_hdm_mbo(mbo);
-	atomic_inc(&c->mbo_nq_level);
 }
 EXPORT_SYMBOL_GPL(most_put_mbo);
 
@@ -1519,38 +3123,289 @@ EXPORT_SYMBOL_GPL(most_put_mbo);
  * hardware and copied to the buffer of the MBO.
  *
  * In case the channel has been poisoned it puts the buffer in the trash queue.
- * Otherwise, it passes the buffer to an AIM for further processing.
+ * Otherwise, it offers the buffer to every AIM that started the channel.
  */
 static void most_read_completion(struct mbo *mbo)
 {
 	struct most_c_obj *c = mbo->context;
+	struct most_c_aim_obj *a;
+	struct most_aim *aim;
+	int level;
+
+	trace_most_read_completion(c->inst->dev_id, mbo);
+	mbo->ts_complete = ktime_get();
+	hist_add(c, HIST_HDM, mbo->ts_enqueue, mbo->ts_complete);
+	if (mbo->status == MBO_E_CLOSE)
+		stats_add(c, STAT_E_CLOSE, 1);
 
 	if (unlikely(c->is_poisoned || (mbo->status == MBO_E_CLOSE))) {
 		trash_mbo(mbo);
 		return;
 	}
 
+	/* a dropped invalid buffer leaves a gap in the sequence numbers */
+	stamp_mbo(c, mbo);
 	if (mbo->status == MBO_E_INVAL) {
+		stats_add(c, STAT_E_INVAL, 1);
+		mbo->ts_submit = mbo->ts_complete;
+		nq_level_inc(c);
 		nq_hdm_mbo(mbo);
-		atomic_inc(&c->mbo_nq_level);
 		return;
 	}
 
-	if (atomic_sub_and_test(1, &c->mbo_nq_level))
+	level = atomic_dec_return(&c->mbo_nq_level);
+	stats_nq_level(c, level);
+	if (!level) {
 		c->is_starving = 1;
+		stats_add(c, STAT_STARVED, 1);
+		channel_event(c, MOST_EV_STARVING);
+		if (c->elastic)
+			schedule_work(&c->grow_work);
+	}
+
+	stats_xfer(c, mbo->processed_length);
+
+	/* the core holds a reference while offering the buffer */
+	atomic_set(&mbo->refs, 1);
+	rcu_read_lock();
+	list_for_each_entry_rcu(a, &c->aim_list, list) {
+		aim = a->ptr;
+		if (!a->refs || !aim || !aim->rx_completion)
+			continue;
+		atomic_inc(&mbo->refs);
+		if (aim->rx_completion(mbo))
+			atomic_dec(&mbo->refs);
+	}
+	rcu_read_unlock();
+
+	most_put_mbo(mbo);
+}
+
+/**
+ * grow_pool - adds MBOs to a running channel
+ * @c: pointer to channel object
+ * @n: number of MBOs to be added
+ */
+static void grow_pool(struct most_c_obj *c, int n)
+{
+	size_t size = c->hdm_cfg.buffer_size + c->hdm_cfg.extra_len;
+	struct mbo *mbo;
+
+	for (; n > 0; n--) {
+		mbo = alloc_mbo(c, size);
+		if (!mbo)
+			break;
+		mbo->num_buffers_ptr = &dummy_num_buffers;
+		atomic_inc(&c->mbo_ref);
+		if (c->cfg.direction == MOST_CH_RX) {
+			mbo->complete = most_read_completion;
+			mbo->ts_submit = ktime_get();
+			nq_level_inc(c);
+			nq_hdm_mbo(mbo);
+		} else {
+			mbo->complete = most_write_completion;
+			arm_mbo(mbo);
+		}
+	}
+}
+
+/**
+ * shrink_pool - retires MBOs of a running channel
+ * @c: pointer to channel object
+ * @n: number of MBOs to be retired
+ *
+ * Free Tx MBOs are released at once, the remaining ones when they return
+ * to the core the next time.
+ */
+static void shrink_pool(struct most_c_obj *c, int n)
+{
+	struct mbo *mbo;
+
+	if (c->cfg.direction == MOST_CH_TX) {
+		for (; n > 0; n--) {
+			mbo = ptr_ring_consume_any(&c->fifo);
+			if (!mbo)
+				break;
+			most_free_mbo_coherent(mbo);
+		}
+	}
+	atomic_add(n, &c->mbo_surplus);
+}
+
+/**
+ * elastic_grow_work - adds MBOs to a starving channel
+ * @work: grow_work of the channel object
+ *
+ * This first cancels pending retirements and then allocates MBOs until
+ * elastic_step MBOs have been added or elastic_max is reached. The
+ * shrinking of the pool is postponed by idle_time.
+ */
+static void elastic_grow_work(struct work_struct *work)
+{
+	struct most_c_obj *c = container_of(work, struct most_c_obj,
+					    grow_work);
+	int n;
+
+	if (!c->elastic)
+		return;
+
+	n = c->elastic_step - atomic_xchg(&c->mbo_surplus, 0);
+	n = min(n, c->elastic_max - atomic_read(&c->mbo_ref));
+	grow_pool(c, n);
+	mod_delayed_work(system_wq, &c->shrink_work,
+			 msecs_to_jiffies(c->idle_time));
+}
 
-	c->stats.pkts++;
-	c->stats.bytes += mbo->processed_length;
+/**
+ * elastic_shrink_work - releases surplus MBOs of an idle channel
+ * @work: shrink_work of the channel object
+ *
+ * This retires up to elastic_step MBOs above elastic_min. The work is
+ * repeated after idle_time until elastic_min is reached or the channel
+ * starves again.
+ */
+static void elastic_shrink_work(struct work_struct *work)
+{
+	struct most_c_obj *c = container_of(to_delayed_work(work),
+					    struct most_c_obj, shrink_work);
+	int n;
 
-	if (c->aim0.refs && c->aim0.ptr->rx_completion &&
-	    c->aim0.ptr->rx_completion(mbo) == 0)
+	if (!c->elastic)
 		return;
 
-	if (c->aim1.refs && c->aim1.ptr->rx_completion &&
-	    c->aim1.ptr->rx_completion(mbo) == 0)
+	flush_trash_fifo(c);
+	n = atomic_read(&c->mbo_ref) - atomic_read(&c->mbo_surplus) -
+	    c->elastic_min;
+	if (n <= 0)
 		return;
 
-	most_put_mbo(mbo);
+	shrink_pool(c, min(n, c->elastic_step));
+	schedule_delayed_work(&c->shrink_work,
+			      msecs_to_jiffies(c->idle_time));
+}
+
+/**
+ * config_changes - tells in which fields two configurations differ
+ * @a: configuration to be applied
+ * @b: configuration applied last
+ *
+ * Returns a mask of most_config_field values, with all bits set if the
+ * direction or data type differ. The extra_len is set by the HDM and
+ * therefore not compared.
+ */
+static unsigned int config_changes(const struct most_channel_config *a,
+				   const struct most_channel_config *b)
+{
+	unsigned int changes = 0;
+
+	if (a->direction != b->direction || a->data_type != b->data_type)
+		return UINT_MAX;
+	if (a->num_buffers != b->num_buffers)
+		changes |= MOST_CFG_NUM_BUFFERS;
+	if (a->buffer_size != b->buffer_size)
+		changes |= MOST_CFG_BUFFER_SIZE;
+	if (a->subbuffer_size != b->subbuffer_size)
+		changes |= MOST_CFG_SUBBUFFER_SIZE;
+	if (a->packets_per_xact != b->packets_per_xact)
+		changes |= MOST_CFG_PACKETS_PER_XACT;
+	return changes;
+}
+
+/**
+ * elastic_limits - computes the bounds of the elastic pool of a channel
+ * @c: pointer to channel object
+ */
+static void elastic_limits(struct most_c_obj *c)
+{
+	c->elastic_max = max_t(int, c->max_buffers, c->cfg.num_buffers);
+	c->elastic_min = c->min_buffers ?
+			 min_t(int, c->min_buffers, c->cfg.num_buffers) :
+			 c->cfg.num_buffers;
+	c->elastic_step = max_t(int, c->cfg.num_buffers / 4, 1);
+}
+
+/**
+ * start_channel - configures a channel and hands its buffers to the HDM
+ * @c: pointer to channel object
+ *
+ * Must be called with the start_mutex held.
+ */
+static int start_channel(struct most_c_obj *c)
+{
+	struct most_interface *iface = c->iface;
+	struct most_c_aim_obj *a;
+	int num_buffer;
+	int ret;
+
+	if (!try_module_get(iface->mod)) {
+		pr_info("failed to acquire HDM lock\n");
+		return -ENOLCK;
+	}
+
+	if (!c->hdm_cfg_valid || config_changes(&c->cfg, &c->hdm_cfg) ||
+	    !iface->restart_channel ||
+	    iface->restart_channel(iface, c->channel_id)) {
+		c->hdm_cfg_valid = false;
+		c->cfg.extra_len = 0;
+		if (iface->configure(iface, c->channel_id, &c->cfg)) {
+			pr_info("channel configuration failed. Go check settings...\n");
+			ret = -EINVAL;
+			goto error;
+		}
+		c->hdm_cfg = c->cfg;
+		c->hdm_cfg_valid = true;
+	}
+
+	elastic_limits(c);
+
+	if (!c->keep_mbo ||
+	    c->pool_cfg.num_buffers != c->cfg.num_buffers ||
+	    c->pool_cfg.buffer_size != c->hdm_cfg.buffer_size ||
+	    c->pool_cfg.extra_len != c->hdm_cfg.extra_len)
+		free_mbo_pool(c);
+
+	ret = ptr_ring_resize(&c->fifo, c->elastic_max + FIFO_HEADROOM,
+			      GFP_KERNEL, NULL);
+	if (ret)
+		goto error;
+
+	c->is_starving = 0;
+	list_for_each_entry(a, &c->aim_list, list)
+		atomic_set(&a->in_use, 0);
+	atomic_set(&c->mbo_surplus, 0);
+	reinit_completion(&c->cleanup);
+
+	/* started first, since armed MBOs may be owned by the HDM at once */
+	ret = run_enqueue_thread(c, c->channel_id);
+	if (ret)
+		goto error;
+
+	if (c->cfg.direction == MOST_CH_RX)
+		num_buffer = arm_mbo_chain(c, c->cfg.direction,
+					   most_read_completion);
+	else
+		num_buffer = arm_mbo_chain(c, c->cfg.direction,
+					   most_write_completion);
+	if (unlikely(!num_buffer)) {
+		pr_info("failed to allocate memory\n");
+		ret = -ENOMEM;
+		goto err_stop_thread;
+	}
+
+	c->elastic = c->max_buffers && c->cfg.num_buffers &&
+		     (c->elastic_max > c->cfg.num_buffers ||
+		      c->elastic_min < c->cfg.num_buffers);
+	if (c->elastic)
+		schedule_delayed_work(&c->shrink_work,
+				      msecs_to_jiffies(c->idle_time));
+	return 0;
+
+err_stop_thread:
+	kthread_stop(c->hdm_enqueue_task);
+	c->hdm_enqueue_task = NULL;
+error:
+	module_put(iface->mod);
+	return ret;
 }
 
 /**
@@ -1566,67 +3421,124 @@ static void most_read_completion(struct mbo *mbo)
 int most_start_channel(struct most_interface *iface, int id,
 		       struct most_aim *aim)
 {
-	int num_buffer;
+	struct most_c_aim_obj *a;
 	int ret;
 	struct most_c_obj *c = get_channel_by_iface(iface, id);
 
 	if (unlikely(!c))
 		return -EINVAL;
 
-	mutex_lock(&c->start_mutex);
-	if (c->aim0.refs + c->aim1.refs > 0)
+	lock_start_mutex(c);
+	if (c->aim_refs > 0)
 		goto out; /* already started by other aim */
 
-	if (!try_module_get(iface->mod)) {
-		pr_info("failed to acquire HDM lock\n");
+	ret = start_channel(c);
+	if (ret) {
 		mutex_unlock(&c->start_mutex);
-		return -ENOLCK;
+		return ret;
 	}
 
-	c->cfg.extra_len = 0;
-	if (c->iface->configure(c->iface, c->channel_id, &c->cfg)) {
-		pr_info("channel configuration failed. Go check settings...\n");
-		ret = -EINVAL;
-		goto error;
+out:
+	a = get_aim_link(c, aim);
+	if (a) {
+		if (!a->refs++)
+			c->aims_running++;
+		c->aim_refs++;
 	}
+	mutex_unlock(&c->start_mutex);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(most_start_channel);
 
-	init_waitqueue_head(&c->hdm_fifo_wq);
+/**
+ * stop_channel_begin - poisons a channel and flushes its fifos
+ * @c: pointer to channel object
+ *
+ * Must be called with the start_mutex held. The buffers still owned by the
+ * HDM or the AIMs are collected afterwards by waiting for c->cleanup.
+ */
+static int stop_channel_begin(struct most_c_obj *c)
+{
+	struct most_interface *iface = c->iface;
 
-	if (c->cfg.direction == MOST_CH_RX)
-		num_buffer = arm_mbo_chain(c, c->cfg.direction,
-					   most_read_completion);
-	else
-		num_buffer = arm_mbo_chain(c, c->cfg.direction,
-					   most_write_completion);
-	if (unlikely(!num_buffer)) {
-		pr_info("failed to allocate memory\n");
-		ret = -ENOMEM;
-		goto error;
-	}
+	elastic_stop(c);
+	hrtimer_cancel(&c->coalesce_timer);
+	if (c->hdm_enqueue_task)
+		kthread_stop(c->hdm_enqueue_task);
+	c->hdm_enqueue_task = NULL;
 
-	ret = run_enqueue_thread(c, id);
-	if (ret)
-		goto error;
+	if (iface->mod)
+		module_put(iface->mod);
 
-	c->is_starving = 0;
-	c->aim0.num_buffers = c->cfg.num_buffers / 2;
-	c->aim1.num_buffers = c->cfg.num_buffers - c->aim0.num_buffers;
-	atomic_set(&c->mbo_ref, num_buffer);
+	/* retired MBOs are freed, all others are kept until the restart */
+	flush_trash_fifo(c);
+	if (c->keep_mbo) {
+		c->pool_cfg = c->hdm_cfg;
+		c->park_mbo = true;
+	}
+	spin_lock_irq(&c->fifo_lock);
+	c->is_poisoned = true;
+	spin_unlock_irq(&c->fifo_lock);
+	wait_for_direct_nq(c);
+	channel_event(c, MOST_EV_POISONED);
 
-out:
-	if (aim == c->aim0.ptr)
-		c->aim0.refs++;
-	if (aim == c->aim1.ptr)
-		c->aim1.refs++;
-	mutex_unlock(&c->start_mutex);
+	if (iface->poison_channel(iface, c->channel_id)) {
+		pr_err("Cannot stop channel %d of mdev %s\n", c->channel_id,
+		       iface->description);
+		c->hdm_cfg_valid = false;
+		c->park_mbo = false;
+		return -EAGAIN;
+	}
+	flush_trash_fifo(c);
+	flush_channel_fifos(c);
 	return 0;
+}
 
-error:
-	module_put(iface->mod);
-	mutex_unlock(&c->start_mutex);
-	return ret;
+/**
+ * stop_channel_end - finishes the stop once all buffers are back
+ * @c: pointer to channel object
+ */
+static void stop_channel_end(struct most_c_obj *c)
+{
+	c->park_mbo = false;
+	if (list_empty(&c->mbo_pool))
+		free_mbo_region(c);
+	c->is_poisoned = false;
+}
+
+/**
+ * put_aim_start - drops the start of a channel by an AIM
+ * @c: pointer to channel object
+ * @aim: AIM that stopped the channel
+ */
+static void put_aim_start(struct most_c_obj *c, struct most_aim *aim)
+{
+	struct most_c_aim_obj *a = get_aim_link(c, aim);
+
+	if (a && a->refs) {
+		if (!--a->refs)
+			c->aims_running--;
+		c->aim_refs--;
+	}
+}
+
+/**
+ * drop_aim_starts - forgets the starts of all AIMs of a channel
+ * @c: pointer to channel object
+ *
+ * This is used when a running channel could not be restarted. The stops
+ * of the AIMs are ignored then, since the channel holds neither buffers
+ * nor a reference of the HDM module.
+ */
+static void drop_aim_starts(struct most_c_obj *c)
+{
+	struct most_c_aim_obj *a;
+
+	list_for_each_entry(a, &c->aim_list, list)
+		a->refs = 0;
+	c->aims_running = 0;
+	c->aim_refs = 0;
 }
-EXPORT_SYMBOL_GPL(most_start_channel);
 
 /**
  * most_stop_channel - stops a running channel
@@ -1637,6 +3549,7 @@ int most_stop_channel(struct most_interface *iface, int id,
 		      struct most_aim *aim)
 {
 	struct most_c_obj *c;
+	int ret;
 
 	if (unlikely((!iface) || (id >= iface->num_channels) || (id < 0))) {
 		pr_err("Bad interface or index out of range\n");
@@ -1646,26 +3559,15 @@ int most_stop_channel(struct most_interface *iface, int id,
 	if (unlikely(!c))
 		return -EINVAL;
 
-	mutex_lock(&c->start_mutex);
-	if (c->aim0.refs + c->aim1.refs >= 2)
-		goto out;
-
-	if (c->hdm_enqueue_task)
-		kthread_stop(c->hdm_enqueue_task);
-	c->hdm_enqueue_task = NULL;
-
-	if (iface->mod)
-		module_put(iface->mod);
+	lock_start_mutex(c);
+	if (c->aim_refs != 1)
+		goto out; /* used by other aims or not running */
 
-	c->is_poisoned = true;
-	if (c->iface->poison_channel(c->iface, c->channel_id)) {
-		pr_err("Cannot stop channel %d of mdev %s\n", c->channel_id,
-		       c->iface->description);
+	ret = stop_channel_begin(c);
+	if (ret) {
 		mutex_unlock(&c->start_mutex);
-		return -EAGAIN;
+		return ret;
 	}
-	flush_trash_fifo(c);
-	flush_channel_fifos(c);
 
 #ifdef CMPL_INTERRUPTIBLE
 	if (wait_for_completion_interruptible(&c->cleanup)) {
@@ -1676,18 +3578,215 @@ int most_stop_channel(struct most_interface *iface, int id,
 #else
 	wait_for_completion(&c->cleanup);
 #endif
-	c->is_poisoned = false;
+	stop_channel_end(c);
 
 out:
-	if (aim == c->aim0.ptr)
-		c->aim0.refs--;
-	if (aim == c->aim1.ptr)
-		c->aim1.refs--;
+	put_aim_start(c, aim);
 	mutex_unlock(&c->start_mutex);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(most_stop_channel);
 
+static void stop_work_fn(struct work_struct *work)
+{
+	struct most_c_obj *c = container_of(work, struct most_c_obj,
+					    stop_work);
+	void (*done)(struct most_interface *iface, int id, void *priv);
+	void *priv;
+
+	wait_for_completion(&c->cleanup);
+
+	mutex_lock(&c->start_mutex);
+	stop_channel_end(c);
+	if (c->stop_restart) {
+		c->stop_restart = false;
+		if (start_channel(c)) {
+			pr_err("Cannot restart channel %d of mdev %s\n",
+			       c->channel_id, c->iface->description);
+			drop_aim_starts(c);
+		}
+	} else {
+		put_aim_start(c, c->stop_aim);
+	}
+	done = c->stop_done;
+	priv = c->stop_priv;
+	c->stop_pending = false;
+	mutex_unlock(&c->start_mutex);
+
+	if (done)
+		done(c->iface, c->channel_id, priv);
+}
+
+/**
+ * most_stop_channel_async - stops a channel without waiting for its buffers
+ * @iface: pointer to interface instance
+ * @id: channel ID
+ * @aim: AIM stopping the channel
+ * @done: optional callback, called when the channel has been stopped
+ * @priv: argument of done
+ *
+ * The caller returns as soon as the channel has been poisoned. Waiting for
+ * the buffers held by the HDM is left to stop_work.
+ */
+int most_stop_channel_async(struct most_interface *iface, int id,
+			    struct most_aim *aim,
+			    void (*done)(struct most_interface *iface,
+					 int id, void *priv),
+			    void *priv)
+{
+	struct most_c_obj *c = get_channel_by_iface(iface, id);
+	int ret;
+
+	if (unlikely(!c))
+		return -EINVAL;
+
+	lock_start_mutex(c);
+	if (c->aim_refs == 1) {
+		ret = stop_channel_begin(c);
+		if (!ret) {
+			c->stop_aim = aim;
+			c->stop_done = done;
+			c->stop_priv = priv;
+			c->stop_pending = true;
+			queue_work(system_unbound_wq, &c->stop_work);
+		}
+		mutex_unlock(&c->start_mutex);
+		return ret;
+	}
+	put_aim_start(c, aim);
+	mutex_unlock(&c->start_mutex);
+
+	if (done)
+		done(iface, id, priv);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(most_stop_channel_async);
+
+/**
+ * resize_pool - changes the number of buffers of a running channel
+ * @c: pointer to channel object
+ *
+ * Missing MBOs are allocated and handed to the HDM at once, after pending
+ * retirements have been cancelled. Surplus ones are retired as they return
+ * to the core.
+ */
+static int resize_pool(struct most_c_obj *c)
+{
+	int ref;
+	int n;
+	int ret;
+
+	c->elastic = false;
+	cancel_work_sync(&c->grow_work);
+	cancel_delayed_work_sync(&c->shrink_work);
+	elastic_limits(c);
+	flush_trash_fifo(c);
+	ref = atomic_read(&c->mbo_ref);
+	ret = ptr_ring_resize(&c->fifo,
+			      max(c->elastic_max, ref) + FIFO_HEADROOM,
+			      GFP_KERNEL, NULL);
+	if (ret)
+		return ret;
+
+	n = c->cfg.num_buffers - (ref - atomic_read(&c->mbo_surplus));
+	if (n > 0)
+		n -= atomic_xchg(&c->mbo_surplus, 0);
+	if (n > 0)
+		grow_pool(c, n);
+	else
+		shrink_pool(c, -n);
+	c->hdm_cfg.num_buffers = c->cfg.num_buffers;
+
+	c->elastic = c->max_buffers && c->cfg.num_buffers &&
+		     (c->elastic_max > c->cfg.num_buffers ||
+		      c->elastic_min < c->cfg.num_buffers);
+	if (c->elastic)
+		schedule_delayed_work(&c->shrink_work,
+				      msecs_to_jiffies(c->idle_time));
+	return 0;
+}
+
+/**
+ * most_reconfigure_channel - applies a changed configuration to a running
+ *     channel
+ * @iface: pointer to interface instance
+ * @id: channel ID
+ *
+ * A change of the number of buffers only resizes the pool. Otherwise the
+ * channel is quiesced like on a stop, configured again and restarted with
+ * new buffers, while the AIMs keep it started. This waits for the buffers
+ * held by the AIMs. If the HDM rejects the new configuration, the old one
+ * is restored. If that fails as well, the channel is left stopped.
+ *
+ * If the AIMs do not return their buffers within RECONF_TIMEOUT or the
+ * caller is interrupted, the old configuration is restored and stop_work
+ * restarts the channel as soon as the buffers are back.
+ *
+ * Returns -EBUSY if the HDM cannot change one of the changed fields while
+ * the channel is running.
+ */
+int most_reconfigure_channel(struct most_interface *iface, int id)
+{
+	struct most_c_obj *c = get_channel_by_iface(iface, id);
+	struct most_channel_config old;
+	unsigned int changes;
+	int ret = 0;
+
+	if (unlikely(!c))
+		return -EINVAL;
+
+	lock_start_mutex(c);
+	if (!c->aim_refs || !c->hdm_cfg_valid)
+		goto unlock; /* applied by the next start */
+
+	changes = config_changes(&c->cfg, &c->hdm_cfg);
+	if (!changes)
+		goto unlock;
+	if (changes & ~iface->channel_vector[id].live_config) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	if (changes == MOST_CFG_NUM_BUFFERS) {
+		ret = resize_pool(c);
+		goto unlock;
+	}
+
+	old = c->hdm_cfg;
+	ret = stop_channel_begin(c);
+	if (ret)
+		goto unlock;
+	ret = wait_for_completion_interruptible_timeout(&c->cleanup,
+							RECONF_TIMEOUT);
+	if (ret <= 0) {
+		ret = ret ? -EINTR : -ETIMEDOUT;
+		c->cfg = old;
+		c->stop_aim = NULL;
+		c->stop_done = NULL;
+		c->stop_restart = true;
+		c->stop_pending = true;
+		queue_work(system_unbound_wq, &c->stop_work);
+		goto unlock;
+	}
+	stop_channel_end(c);
+
+	ret = start_channel(c);
+	if (ret) {
+		pr_err("Cannot reconfigure channel %d of mdev %s\n",
+		       c->channel_id, iface->description);
+		c->cfg = old;
+		if (start_channel(c)) {
+			pr_err("Cannot restart channel %d of mdev %s\n",
+			       c->channel_id, iface->description);
+			drop_aim_starts(c);
+		}
+	}
+unlock:
+	mutex_unlock(&c->start_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(most_reconfigure_channel);
+
 /**
  * most_register_aim - registers an AIM (driver) with the core
  * @aim: instance of AIM to be registered
@@ -1736,13 +3835,10 @@ int most_deregister_aim(struct most_aim *aim)
 	}
 	list_for_each_entry_safe(i, i_tmp, &instance_list, list) {
 		list_for_each_entry_safe(c, tmp, &i->channel_list, list) {
-			if (c->aim0.ptr == aim || c->aim1.ptr == aim)
-				aim->disconnect_channel(
-					c->iface, c->channel_id);
-			if (c->aim0.ptr == aim)
-				c->aim0.ptr = NULL;
-			if (c->aim1.ptr == aim)
-				c->aim1.ptr = NULL;
+			if (!get_aim_link(c, aim))
+				continue;
+			aim->disconnect_channel(c->iface, c->channel_id);
+			unlink_aim(c, aim);
 		}
 	}
 	list_del(&aim_obj->list);
@@ -1752,19 +3848,83 @@ int most_deregister_aim(struct most_aim *aim)
 }
 EXPORT_SYMBOL_GPL(most_deregister_aim);
 
-void most_register_config_set(struct most_config_set *cfg_set)
+/**
+ * struct config_index_entry - entry of the configuration index
+ * @node: hash list node, hashed by the channel name of the probe
+ * @probe: matching rule
+ * @set: configuration set the rule belongs to
+ */
+struct config_index_entry {
+	struct hlist_node node;
+	const struct most_config_probe *probe;
+	const struct most_config_set *set;
+};
+
+static u32 config_hash(const char *ch_name)
 {
-	mutex_lock(&config_probes_mt);
-	list_add(&cfg_set->list, &config_probes);
-	mutex_unlock(&config_probes_mt);
+	return full_name_hash(NULL, ch_name, strlen(ch_name));
+}
+
+/**
+ * remove_config_entries - removes the rules of a set from the index
+ * @cfg_set: configuration set
+ *
+ * Must be called with config_probes_sem held for writing.
+ */
+static void remove_config_entries(const struct most_config_set *cfg_set)
+{
+	struct config_index_entry *e;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(config_index, bkt, tmp, e, node) {
+		if (e->set == cfg_set) {
+			hash_del(&e->node);
+			kfree(e);
+		}
+	}
+}
+
+/**
+ * most_register_config_set - adds the rules of a set to the index
+ * @cfg_set: configuration set
+ *
+ * The rules are indexed by channel name. The rules of a set are inserted in
+ * reverse order at the heads of their buckets, so that the rules of the
+ * latest set are matched first and those of one set in their given order.
+ */
+int most_register_config_set(struct most_config_set *cfg_set)
+{
+	const struct most_config_probe *p;
+	struct config_index_entry *e;
+	int n;
+
+	for (n = 0; cfg_set->probes[n].ch_name; n++)
+		;
+
+	down_write(&config_probes_sem);
+	while (n--) {
+		p = cfg_set->probes + n;
+		e = kzalloc(sizeof(*e), GFP_KERNEL);
+		if (!e) {
+			remove_config_entries(cfg_set);
+			up_write(&config_probes_sem);
+			return -ENOMEM;
+		}
+		e->probe = p;
+		e->set = cfg_set;
+		hash_add(config_index, &e->node, config_hash(p->ch_name));
+	}
+	up_write(&config_probes_sem);
+	return 0;
 }
 EXPORT_SYMBOL(most_register_config_set);
 
 void most_deregister_config_set(struct most_config_set *cfg_set)
 {
-	mutex_lock(&config_probes_mt);
-	list_del(&cfg_set->list);
-	mutex_unlock(&config_probes_mt);
+	down_write(&config_probes_sem);
+	remove_config_entries(cfg_set);
+	up_write(&config_probes_sem);
 }
 EXPORT_SYMBOL(most_deregister_config_set);
 
@@ -1783,15 +3943,27 @@ static int probe_aim(struct most_c_obj *c,
 	return 0;
 }
 
-static void probe_config_set(struct most_c_obj *c,
-			     const char *dev_name, const char *ch_name,
-			     const struct most_config_probe *p)
+/**
+ * find_configuration - applies the matching rules to a channel
+ * @c: pointer to channel object
+ * @dev_name: description of the interface
+ * @ch_name: name of the channel
+ *
+ * Only the rules of the channel name's bucket are looked at. The device
+ * name of a rule may be a glob pattern, e.g. "usb_device 1-*".
+ */
+static void find_configuration(struct most_c_obj *c, const char *dev_name,
+			       const char *ch_name)
 {
+	const struct most_config_probe *p;
+	struct config_index_entry *e;
 	int err;
 
-	for (; p->ch_name; p++) {
-		if ((p->dev_name && strcmp(dev_name, p->dev_name)) ||
-		    strcmp(ch_name, p->ch_name))
+	down_read(&config_probes_sem);
+	hash_for_each_possible(config_index, e, node, config_hash(ch_name)) {
+		p = e->probe;
+		if (strcmp(ch_name, p->ch_name) ||
+		    (p->dev_name && !glob_match(p->dev_name, dev_name)))
 			continue;
 		if (p->cfg)
 			c->cfg = *p->cfg;
@@ -1803,18 +3975,72 @@ static void probe_config_set(struct most_c_obj *c,
 				       p->aim_param ? p->aim_param : "", err);
 		}
 	}
+	up_read(&config_probes_sem);
 }
 
-static void find_configuration(struct most_c_obj *c, const char *dev_name,
-			       const char *ch_name)
+/**
+ * link_channel - applies the configuration sets to a channel
+ * @c: pointer to channel object
+ *
+ * This records the time it took and signals links_done of the instance
+ * once the last channel is linked.
+ */
+static void link_channel(struct most_c_obj *c)
+{
+	struct most_inst_obj *inst = c->inst;
+	ktime_t start = ktime_get();
+
+	find_configuration(c, c->iface->description, kobject_name(&c->kobj));
+	c->link_time = ktime_sub(ktime_get(), start);
+	pr_debug("linked %s:%s in %lld us\n", kobject_name(&inst->kobj),
+		 kobject_name(&c->kobj), ktime_to_us(c->link_time));
+	if (atomic_dec_and_test(&inst->links_pending))
+		complete_all(&inst->links_done);
+}
+
+static void link_work_fn(struct work_struct *work)
 {
-	struct most_config_set *plist;
+	link_channel(container_of(work, struct most_c_obj, link_work));
+}
+
+/**
+ * most_irq_poll - polls the completions of an interface
+ * @iop: irq_poll of the instance
+ * @budget: maximum number of MBOs to be completed
+ *
+ * This runs in softirq context. If the HDM completed less than budget
+ * MBOs, polling ends and the HDM is told to re-enable its interrupt.
+ * Otherwise, the core polls again in the next round.
+ */
+static int most_irq_poll(struct irq_poll *iop, int budget)
+{
+	struct most_inst_obj *inst = container_of(iop, struct most_inst_obj,
+						  iop);
+	struct most_interface *iface = inst->iface;
+	int done = iface->poll(iface, budget);
+
+	if (done < budget) {
+		irq_poll_complete(iop);
+		if (iface->poll_complete)
+			iface->poll_complete(iface);
+	}
+	return done;
+}
 
-	mutex_lock(&config_probes_mt);
-	list_for_each_entry(plist, &config_probes, list)
-		probe_config_set(c, dev_name, ch_name, plist->probes);
-	mutex_unlock(&config_probes_mt);
+/**
+ * most_poll_schedule - schedules the polling of an interface's completions
+ * @iface: pointer to the interface instance description.
+ *
+ * Called by an HDM with poll() from its completion interrupt, which it
+ * should disable until poll_complete() is called.
+ */
+void most_poll_schedule(struct most_interface *iface)
+{
+	struct most_inst_obj *inst = iface->priv;
+
+	irq_poll_sched(&inst->iop);
 }
+EXPORT_SYMBOL_GPL(most_poll_schedule);
 
 /**
  * most_register_interface - registers an interface with core
@@ -1855,8 +4081,14 @@ struct kobject *most_register_interface(struct most_interface *iface)
 	iface->priv = inst;
 	INIT_LIST_HEAD(&inst->channel_list);
 	inst->iface = iface;
+	if (iface->poll)
+		irq_poll_init(&inst->iop, iface->poll_weight ?: POLL_WEIGHT,
+			      most_irq_poll);
 	inst->dev_id = id;
+	inst->debugfs_dir = debugfs_create_dir(name, most_debugfs);
+	mutex_lock(&instance_mutex);
 	list_add_tail(&inst->list, &instance_list);
+	mutex_unlock(&instance_mutex);
 
 	for (i = 0; i < iface->num_channels; i++) {
 		const char *name_suffix = iface->channel_vector[i].name_suffix;
@@ -1870,13 +4102,47 @@ struct kobject *most_register_interface(struct most_interface *iface)
 		c = create_most_c_obj(channel_name, &inst->kobj);
 		if (!c)
 			goto free_instance;
+		c->stats = stats_alloc();
+		c->hist = alloc_percpu(struct most_c_hist_buckets);
+		if (!c->stats || !c->hist ||
+		    ptr_ring_init(&c->fifo, 1, GFP_KERNEL)) {
+			kobject_put(&c->kobj);
+			goto free_instance;
+		}
 		inst->channel[i] = c;
 		c->is_starving = 0;
 		c->iface = iface;
 		c->inst = inst;
 		c->channel_id = i;
 		c->keep_mbo = false;
+		c->park_mbo = false;
+		c->min_buffers = 0;
+		c->max_buffers = 0;
+		c->idle_time = 1000;
+		c->elastic = false;
+		atomic_set(&c->mbo_surplus, 0);
+		INIT_WORK(&c->grow_work, elastic_grow_work);
+		INIT_DELAYED_WORK(&c->shrink_work, elastic_shrink_work);
+		INIT_WORK(&c->link_work, link_work_fn);
+		c->coalesce_frames = 0;
+		c->coalesce_usecs = 0;
+		atomic_set(&c->tx_pending, 0);
+		hrtimer_init(&c->coalesce_timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL);
+		c->coalesce_timer.function = coalesce_timer_fn;
+		c->events = 0;
+		INIT_DELAYED_WORK(&c->event_work, event_work_fn);
+		INIT_WORK(&c->stop_work, stop_work_fn);
+		c->stop_pending = false;
+		c->stop_restart = false;
+		c->hdm_cfg_valid = false;
+		ratelimit_state_init(&c->event_rs, EVENT_INTERVAL, EVENT_BURST);
+		ratelimit_set_flags(&c->event_rs, RATELIMIT_MSG_ON_RELEASE);
+		c->sched_policy = MOST_SCHED_AUTO;
+		c->sched_priority = MAX_USER_RT_PRIO / 2;
+		cpumask_copy(&c->cpu_affinity, cpu_possible_mask);
 		c->enqueue_halt = false;
+		c->nq_busy = false;
 		c->is_poisoned = false;
 		c->cfg.direction = 0;
 		c->cfg.data_type = 0;
@@ -1885,23 +4151,44 @@ struct kobject *most_register_interface(struct most_interface *iface)
 		c->cfg.subbuffer_size = 0;
 		c->cfg.packets_per_xact = 0;
 		spin_lock_init(&c->fifo_lock);
-		INIT_LIST_HEAD(&c->fifo);
 		INIT_LIST_HEAD(&c->trash_fifo);
+		INIT_WORK(&c->trash_work, trash_work_fn);
 		INIT_LIST_HEAD(&c->halt_fifo);
+		init_waitqueue_head(&c->hdm_fifo_wq);
 		init_completion(&c->cleanup);
 		atomic_set(&c->mbo_ref, 0);
 		mutex_init(&c->start_mutex);
 		mutex_init(&c->nq_mutex);
+		mutex_lock(&instance_mutex);
 		list_add_tail(&c->list, &inst->channel_list);
-		find_configuration(c, iface->description, channel_name);
+		mutex_unlock(&instance_mutex);
+		debugfs_create_file("latency", 0444,
+				    debugfs_create_dir(channel_name,
+						       inst->debugfs_dir),
+				    c, &latency_fops);
 	}
+
+	/* the extra reference is dropped once all links are scheduled */
+	atomic_set(&inst->links_pending, iface->num_channels + 1);
+	init_completion(&inst->links_done);
+	list_for_each_entry(c, &inst->channel_list, list) {
+		if (async_link)
+			queue_work(system_unbound_wq, &c->link_work);
+		else
+			link_channel(c);
+	}
+	if (atomic_dec_and_test(&inst->links_pending))
+		complete_all(&inst->links_done);
+
 	pr_info("registered new MOST device mdev%d (%s, %u chs)\n",
 		inst->dev_id, iface->description, iface->num_channels);
 	return &inst->kobj;
 
 free_instance:
 	pr_info("Failed allocate channel(s)\n");
+	mutex_lock(&instance_mutex);
 	list_del(&inst->list);
+	mutex_unlock(&instance_mutex);
 	ida_simple_remove(&mdev_id, id);
 	destroy_most_inst_obj(inst);
 	return ERR_PTR(-ENOMEM);
@@ -1919,6 +4206,7 @@ void most_deregister_interface(struct most_interface *iface)
 {
 	struct most_inst_obj *i = iface->priv;
 	struct most_c_obj *c;
+	struct most_c_aim_obj *a;
 
 	if (unlikely(!i)) {
 		pr_info("Bad Interface\n");
@@ -1926,24 +4214,45 @@ void most_deregister_interface(struct most_interface *iface)
 	}
 	pr_info("deregistering MOST device %s (%s)\n", i->kobj.name,
 		iface->description);
+	wait_for_completion(&i->links_done);
 
 	list_for_each_entry(c, &i->channel_list, list) {
-		if (c->aim0.ptr)
-			c->aim0.ptr->disconnect_channel(c->iface,
-							c->channel_id);
-		if (c->aim1.ptr)
-			c->aim1.ptr->disconnect_channel(c->iface,
-							c->channel_id);
-		c->aim0.ptr = NULL;
-		c->aim1.ptr = NULL;
+		flush_work(&c->stop_work);
+		list_for_each_entry(a, &c->aim_list, list) {
+			if (a->ptr)
+				a->ptr->disconnect_channel(c->iface,
+							   c->channel_id);
+			a->ptr = NULL;
+		}
 	}
+	if (iface->poll)
+		irq_poll_disable(&i->iop);
 
 	ida_simple_remove(&mdev_id, i->dev_id);
+	mutex_lock(&instance_mutex);
 	list_del(&i->list);
+	mutex_unlock(&instance_mutex);
 	destroy_most_inst_obj(i);
 }
 EXPORT_SYMBOL_GPL(most_deregister_interface);
 
+/**
+ * most_wait_for_links - waits until the channels of an interface are linked
+ * @iface: pointer to the interface instance description.
+ *
+ * With async_link set, the configuration sets are applied to the channels
+ * on a workqueue after most_register_interface() returned. This returns
+ * once all channels have been configured and linked to their AIMs.
+ */
+void most_wait_for_links(struct most_interface *iface)
+{
+	struct most_inst_obj *i = iface->priv;
+
+	if (i)
+		wait_for_completion(&i->links_done);
+}
+EXPORT_SYMBOL_GPL(most_wait_for_links);
+
 /**
  * most_stop_enqueue - prevents core from enqueueing MBOs
  * @iface: pointer to interface
@@ -1953,6 +4262,8 @@ EXPORT_SYMBOL_GPL(most_deregister_interface);
  * is imminent to get run over by the core. The core is not going to
  * enqueue any further packets unless the flagging HDM calls
  * most_resume enqueue().
+ *
+ * Must not be called from atomic context or from within enqueue().
  */
 void most_stop_enqueue(struct most_interface *iface, int id)
 {
@@ -1962,8 +4273,13 @@ void most_stop_enqueue(struct most_interface *iface, int id)
 		return;
 
 	mutex_lock(&c->nq_mutex);
+	spin_lock_irq(&c->fifo_lock);
 	c->enqueue_halt = true;
+	spin_unlock_irq(&c->fifo_lock);
 	mutex_unlock(&c->nq_mutex);
+	wait_for_direct_nq(c);
+	stats_add(c, STAT_HALTED, 1);
+	channel_event(c, MOST_EV_HALTED);
 }
 EXPORT_SYMBOL_GPL(most_stop_enqueue);
 
@@ -1983,13 +4299,37 @@ void most_resume_enqueue(struct most_interface *iface, int id)
 		return;
 
 	mutex_lock(&c->nq_mutex);
+	spin_lock_irq(&c->fifo_lock);
 	c->enqueue_halt = false;
+	spin_unlock_irq(&c->fifo_lock);
 	mutex_unlock(&c->nq_mutex);
+	stats_add(c, STAT_RESUMED, 1);
+	channel_event(c, MOST_EV_RESUMED);
 
 	wake_up_interruptible(&c->hdm_fifo_wq);
 }
 EXPORT_SYMBOL_GPL(most_resume_enqueue);
 
+/**
+ * most_channel_event - reports an event of a channel to user space
+ * @iface: pointer to interface
+ * @id: channel id
+ * @ev: event
+ *
+ * HDMs use this for events the core cannot see, like the recovery from
+ * a stalled pipe.
+ */
+void most_channel_event(struct most_interface *iface, int id,
+			enum most_channel_event ev)
+{
+	struct most_c_obj *c = get_channel_by_iface(iface, id);
+
+	if (!c || ev >= MOST_EV_NUM)
+		return;
+	channel_event(c, ev);
+}
+EXPORT_SYMBOL_GPL(most_channel_event);
+
 /**
  * most_deliver_netinfo - interface for HDM to inform AIMs about HW's MAC
  * @param iface - most interface instance
@@ -2012,13 +4352,16 @@ static int __init most_init(void)
 	int err;
 
 	pr_info("init()\n");
-	mutex_init(&config_probes_mt);
 	ida_init(&mdev_id);
 
+	mbo_cache = KMEM_CACHE(mbo, 0);
+	if (!mbo_cache)
+		return -ENOMEM;
+
 	err = bus_register(&most_bus);
 	if (err) {
 		pr_info("Cannot register most bus\n");
-		return err;
+		goto exit_cache;
 	}
 
 	most_class = class_create(THIS_MODULE, "most");
@@ -2052,6 +4395,9 @@ static int __init most_init(void)
 		goto exit_driver_kset;
 	}
 
+	most_debugfs = debugfs_create_dir("most", NULL);
+	debugfs_create_file("snapshot", 0444, most_debugfs, NULL,
+			    &snapshot_fops);
 	return 0;
 
 exit_driver_kset:
@@ -2064,6 +4410,8 @@ exit_class:
 	class_destroy(most_class);
 exit_bus:
 	bus_unregister(&most_bus);
+exit_cache:
+	kmem_cache_destroy(mbo_cache);
 	return err;
 }
 
@@ -2081,12 +4429,14 @@ static void __exit most_exit(void)
 		list_del(&i->list);
 		destroy_most_inst_obj(i);
 	}
+	debugfs_remove_recursive(most_debugfs);
 	kset_unregister(most_inst_kset);
 	kset_unregister(most_aim_kset);
 	device_destroy(most_class, 0);
 	driver_unregister(&mostcore);
 	class_destroy(most_class);
 	bus_unregister(&most_bus);
+	kmem_cache_destroy(mbo_cache);
 	ida_destroy(&mdev_id);
 }
 
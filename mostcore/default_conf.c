@@ -143,8 +143,7 @@ static struct most_config_set config_set = {
 
 static int __init mod_init(void)
 {
-	most_register_config_set(&config_set);
-	return 0;
+	return most_register_config_set(&config_set);
 }
 
 static void __exit mod_exit(void)
@@ -0,0 +1,72 @@
+/*
+ * most_snapshot.h - Binary snapshot of the MOST channels
+ *
+ * Copyright (C) 2013-2017, Microchip Technology Germany II GmbH & Co. KG
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This file is licensed under GPLv2.
+ */
+
+#ifndef __MOST_SNAPSHOT_H__
+#define __MOST_SNAPSHOT_H__
+
+#include <linux/types.h>
+
+/*
+ * Reading /sys/kernel/debug/most/snapshot from offset 0 returns a
+ * struct most_snapshot_hdr followed by num_channels records of
+ * record_size bytes each, which start with a struct most_snapshot_channel.
+ * New fields are only appended to the record, hence readers have to
+ * advance by record_size rather than by the size of the structure.
+ */
+#define MOST_SNAPSHOT_VERSION	1
+
+struct most_snapshot_hdr {
+	__u32 version;
+	__u32 record_size;
+	__u32 num_channels;
+	__u32 reserved;
+	__u64 timestamp_ns; /* CLOCK_MONOTONIC */
+};
+
+/* channel flags */
+#define MOST_SNAPSHOT_RUNNING	0x0001
+#define MOST_SNAPSHOT_POISONED	0x0002
+#define MOST_SNAPSHOT_HALTED	0x0004 /* most_stop_enqueue() */
+#define MOST_SNAPSHOT_STARVING	0x0008
+
+struct most_snapshot_channel {
+	__u32 dev_id; /* N of mdevN */
+	__u16 channel_id;
+	__u16 flags;
+	__u32 direction; /* enum most_channel_direction */
+	__u32 data_type; /* enum most_channel_data_type */
+	__u32 buffer_size;
+	__u16 num_buffers;
+	__u16 subbuffer_size;
+	__u16 packets_per_xact;
+	__u16 extra_len; /* saturated at 0xffff, see extra_len32 */
+	__u32 mbo_ref; /* allocated buffers */
+	__u32 fifo; /* free Tx buffers */
+	__u32 halt_fifo; /* buffers held back by the core */
+	__u32 nq_level; /* buffers queued for or owned by the HDM */
+	__u32 aims_running; /* linked AIMs that started the channel */
+	/* as in extended_statistics */
+	__u64 bytes;
+	__u64 packets;
+	__u64 e_inval;
+	__u64 e_close;
+	__u64 starved;
+	__u64 halted;
+	__u64 resumed;
+	__u64 nq_high;
+	__u64 nq_low;
+	__u32 extra_len32;
+	__u32 reserved;
+};
+
+#endif /* __MOST_SNAPSHOT_H__ */
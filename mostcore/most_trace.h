@@ -0,0 +1,111 @@
+/*
+ * most_trace.h - Trace points of the MOST core
+ *
+ * Copyright (C) 2013-2017, Microchip Technology Germany II GmbH & Co. KG
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This file is licensed under GPLv2.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM most
+
+#if !defined(__MOST_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __MOST_TRACE_H__
+
+#include <linux/tracepoint.h>
+#include "mostcore.h"
+
+DECLARE_EVENT_CLASS(most_mbo,
+
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+
+	TP_ARGS(dev_id, mbo),
+
+	TP_STRUCT__entry(
+		__field(int, dev_id)
+		__field(u16, ch_id)
+		__field(const void *, mbo)
+		__field(u32, buffer_length)
+		__field(u32, processed_length)
+		__field(int, status)
+	),
+
+	TP_fast_assign(
+		__entry->dev_id = dev_id;
+		__entry->ch_id = mbo->hdm_channel_id;
+		__entry->mbo = mbo;
+		__entry->buffer_length = mbo->buffer_length;
+		__entry->processed_length = mbo->processed_length;
+		__entry->status = mbo->status;
+	),
+
+	TP_printk("mdev%d ch%u mbo=%p len=%u processed=%u status=%d",
+		  __entry->dev_id, __entry->ch_id, __entry->mbo,
+		  __entry->buffer_length, __entry->processed_length,
+		  __entry->status)
+);
+
+/* AIM took a free buffer */
+DEFINE_EVENT(most_mbo, most_get_mbo,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+/* AIM submitted a Tx buffer */
+DEFINE_EVENT(most_mbo, most_submit_mbo,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+/* buffer queued for the HDM */
+DEFINE_EVENT(most_mbo, most_nq_hdm_mbo,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+/* buffer handed to the HDM */
+DEFINE_EVENT(most_mbo, most_hdm_enqueue,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+DEFINE_EVENT(most_mbo, most_read_completion,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+DEFINE_EVENT(most_mbo, most_write_completion,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+/* Tx buffer returned to the free pool */
+DEFINE_EVENT(most_mbo, most_arm_mbo,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+/* AIM released a buffer */
+DEFINE_EVENT(most_mbo, most_put_mbo,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+/* buffer of a poisoned channel scheduled to be freed */
+DEFINE_EVENT(most_mbo, most_trash_mbo,
+	TP_PROTO(int dev_id, const struct mbo *mbo),
+	TP_ARGS(dev_id, mbo)
+);
+
+#endif /* __MOST_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE most_trace
+#include <trace/define_trace.h>
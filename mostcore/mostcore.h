@@ -23,9 +23,12 @@
 #define __MOST_CORE_H__
 
 #include <linux/types.h>
+#include <linux/ktime.h>
 
 struct kobject;
 struct module;
+struct task_struct;
+struct cpumask;
 
 /**
  * Interface type
@@ -60,6 +63,17 @@ enum most_channel_data_type {
 	MOST_CH_SYNC = 1 << 5,
 };
 
+/**
+ * Fields of the channel configuration, used to tell which of them an HDM
+ * can change while the channel is running.
+ */
+enum most_config_field {
+	MOST_CFG_NUM_BUFFERS = 1 << 0,
+	MOST_CFG_BUFFER_SIZE = 1 << 1,
+	MOST_CFG_SUBBUFFER_SIZE = 1 << 2,
+	MOST_CFG_PACKETS_PER_XACT = 1 << 3,
+};
+
 enum mbo_status_flags {
 	/* MBO was processed successfully (data was send or received )*/
 	MBO_SUCCESS = 0,
@@ -69,6 +83,23 @@ enum mbo_status_flags {
 	MBO_E_CLOSE,
 };
 
+/**
+ * Channel events reported to user space by uevents.
+ */
+enum most_channel_event {
+	/* all Rx buffers have been completed, none is left with the HDM */
+	MOST_EV_STARVING,
+	/* the HDM stopped the enqueueing of buffers */
+	MOST_EV_HALTED,
+	/* the HDM resumed the enqueueing of buffers */
+	MOST_EV_RESUMED,
+	/* the channel is being stopped */
+	MOST_EV_POISONED,
+	/* the HDM recovers from a stalled transfer */
+	MOST_EV_STALL,
+	MOST_EV_NUM
+};
+
 /**
  * struct most_channel_capability - Channel capability
  * @direction: Supported channel directions.
@@ -89,6 +120,11 @@ enum mbo_status_flags {
  * for streaming data types (Sync,AV Packetized)
  * @name_suffix: Optional suffix provided by an HDM that is attached to the
  * regular channel name.
+ * @live_config: Bitwise OR-combination of the values from the enumeration
+ * most_config_field the HDM can change while the channel is running. The
+ * core then quiesces the channel and calls configure() again, but only
+ * for fields other than the number of buffers, which is handled by the
+ * core alone. Zero means the channel has to be stopped to be reconfigured.
  *
  * Describes the capabilities of a MostCore channel like supported Data Types
  * and directions. This information is provided by an HDM for the MostCore.
@@ -109,10 +145,11 @@ struct most_channel_capability {
 	u16 direction;
 	u16 data_type;
 	u16 num_buffers_packet;
-	u16 buffer_size_packet;
+	u32 buffer_size_packet;
 	u16 num_buffers_streaming;
-	u16 buffer_size_streaming;
+	u32 buffer_size_streaming;
 	const char *name_suffix;
+	u16 live_config;
 };
 
 /**
@@ -122,7 +159,8 @@ struct most_channel_capability {
  * @num_buffers: number of buffers
  * @buffer_size: size of a buffer for AIM.
  * Buffer size may be cutted down by HDM in a configure callback
- * to match to a given interface and channel type.
+ * to match to a given interface and channel type. Buffers are contiguous
+ * and may exceed 64 KiB if the HDM supports it.
  * @extra_len: additional buffer space for internal HDM purposes like padding.
  * May be set by HDM in a configure callback if needed.
  * @subbuffer_size: size of a subbuffer
@@ -137,8 +175,8 @@ struct most_channel_config {
 	enum most_channel_direction direction;
 	enum most_channel_data_type data_type;
 	u16 num_buffers;
-	u16 buffer_size;
-	u16 extra_len;
+	u32 buffer_size;
+	u32 extra_len;
 	u16 subbuffer_size;
 	u16 packets_per_xact;
 };
@@ -147,8 +185,8 @@ struct most_channel_config {
  * struct most_config_probe - matching rule, channel configuration and
  *     the optional AIM name used for the automatic configuration and linking
  *     of the channel
- * @dev_name: optional mathing device id
- *     ("usb_device 1-1:1.0," "dim2-12345678", etc.)
+ * @dev_name: optional mathing device id, may be a glob pattern
+ *     ("usb_device 1-1:1.0," "dim2-12345678", "usb_device 1-*", etc.)
  * @ch_name: matching channel name ("ep8f", "ca2", etc.)
  * @cfg: configuration that will be applied for the found channel
  * @aim_name: optional name of the AIM that will be linked to the channel
@@ -169,11 +207,9 @@ struct most_config_probe {
  *     several automatic configurations for the different channels
  * @probes: list of the matching rules and the confugurations,
  *     that must be ended with the empty structure
- * @list: list head used by the MostCore
  */
 struct most_config_set {
 	const struct most_config_probe *probes;
-	struct list_head list;
 };
 
 /*
@@ -193,6 +229,18 @@ struct most_config_set {
  * @processed_length: (out) processed length
  * @status: (out) transfer status
  * @complete: (in) completion routine
+ * @ts_get: time the buffer was handed to the AIM, for use by MostCore
+ * @ts_submit: time the buffer was queued for the HDM, for use by MostCore
+ * @ts_enqueue: time the buffer was handed to the HDM, for use by MostCore
+ * @ts_complete: time the HDM completed the buffer, for use by MostCore
+ * @ts_release: time the AIM returned the buffer, for use by MostCore
+ * @refs: number of holders of a received buffer, for use by MostCore
+ * @hw_ts: (out) time the hardware completed the transfer, taken by the HDM
+ *   as close to the hardware as it can. If the HDM leaves it unset, MostCore
+ *   uses the time the completion routine was called. Read by the AIMs.
+ * @seq: sequence number of the buffer in its channel, set by MostCore on
+ *   completion. A gap between the sequence numbers of two received buffers
+ *   tells that buffers were lost on the way. Read by the AIMs.
  *
  * The MostCore allocates and initializes the MBO.
  *
@@ -222,14 +270,22 @@ struct mbo {
 	void *priv;
 	struct list_head list;
 	struct most_interface *ifp;
-	int *num_buffers_ptr;
+	atomic_t *num_buffers_ptr;
 	u16 hdm_channel_id;
 	void *virt_address;
 	dma_addr_t bus_address;
-	u16 buffer_length;
-	u16 processed_length;
+	u32 buffer_length;
+	u32 processed_length;
 	enum mbo_status_flags status;
 	void (*complete)(struct mbo *);
+	ktime_t ts_get;
+	ktime_t ts_submit;
+	ktime_t ts_enqueue;
+	ktime_t ts_complete;
+	ktime_t ts_release;
+	atomic_t refs;
+	ktime_t hw_ts;
+	u32 seq;
 };
 
 /**
@@ -260,6 +316,15 @@ struct mbo {
  *   In this case the HDM shall hold MBOs and service the channel as usual.
  *   The HDM must be able to hold at least one MBO for each channel.
  *   The callback returns a negative value on error, otherwise 0.
+ * @enqueue_atomic Set by the HDM if enqueue() may be called in atomic
+ *   context. The core then hands MBOs over directly from the context that
+ *   submits them, and uses its enqueue thread only while the HDM has
+ *   stopped enqueueing or if enqueue() returns an error.
+ * @enqueue_batch Optional. Delivers all MBOs waiting for the channel in
+ *   one call instead of calling enqueue() for each of them. The HDM removes
+ *   every MBO it takes over from the list. It may leave MBOs on the list
+ *   only if it returns a negative value; these are kept by the core for a
+ *   later retry. Otherwise the same rules as for enqueue() apply.
  * @poison_channel Informs HDM about closing the channel. The HDM shall
  *   cancel all transfers and synchronously or asynchronously return
  *   all enqueued for this channel MBOs using the completion routine.
@@ -272,6 +337,25 @@ struct mbo {
  *   The default implementation uses dma_alloc_coherent.
  * @free_mbo_buf: must free the buffer allocated by alloc_mbo_buf,
  *   if set. The default implementation will use dma_free_coherent.
+ * @set_irq_affinity: Optional. Called with the union of the CPU affinities
+ *   of all channels whenever the affinity of a channel changes. HDMs that
+ *   own interrupts use it as their affinity hint, so that completions are
+ *   handled on the CPUs of the consumers. The mask is only valid during the
+ *   call.
+ * @poll: Optional. Completes up to budget MBOs and returns their number.
+ *   Called by the core in softirq context after the HDM asked for it with
+ *   most_poll_schedule(). If less than budget MBOs are completed, polling
+ *   ends and poll_complete is called. This bounds the time spent in the
+ *   interrupt handler and completes MBOs in batches.
+ * @poll_complete: Optional. Called when polling ended. The HDM re-enables
+ *   its completion interrupt and must call most_poll_schedule() again, if
+ *   completions arrived meanwhile.
+ * @poll_weight: Budget of one poll() call. Zero selects the default of 64.
+ * @restart_channel: Optional. Re-opens a poisoned channel with the
+ *   configuration last passed to configure(). The core calls it instead of
+ *   configure() when a channel is started again with unchanged settings.
+ *   Returns 0 on success or a negative value, if the channel needs to be
+ *   configured again, in which case the core falls back to configure().
  * @priv Private field used by mostcore to store context information.
  */
 struct most_interface {
@@ -284,12 +368,21 @@ struct most_interface {
 			 struct most_channel_config *channel_config);
 	int (*enqueue)(struct most_interface *iface, int channel_idx,
 		       struct mbo *mbo);
+	bool enqueue_atomic;
+	int (*enqueue_batch)(struct most_interface *iface, int channel_idx,
+			     struct list_head *mbos);
 	int (*poison_channel)(struct most_interface *iface, int channel_idx);
 	void (*request_netinfo)(struct most_interface *iface, int channel_idx);
 	int (*alloc_mbo_buf)(struct most_interface *iface, int channel_idx,
 			     struct mbo *, size_t size);
 	void (*free_mbo_buf)(struct most_interface *iface, int channel_idx,
 			     struct mbo *, size_t size);
+	void (*set_irq_affinity)(struct most_interface *iface,
+				 const struct cpumask *mask);
+	int (*poll)(struct most_interface *iface, int budget);
+	void (*poll_complete)(struct most_interface *iface);
+	int poll_weight;
+	int (*restart_channel)(struct most_interface *iface, int channel_idx);
 	void *priv;
 };
 
@@ -298,8 +391,14 @@ struct most_interface {
  * @name: Driver name
  * @probe_channel: function for core to notify driver about channel connection
  * @disconnect_channel: callback function to disconnect a certain channel
- * @rx_completion: completion handler for received packets
+ * @rx_completion: completion handler for received packets. A received
+ *   buffer is offered to every AIM linked to the channel. An AIM that
+ *   returns 0 holds a reference and drops it with most_put_mbo(). The buffer
+ *   is shared and must not be modified. The list head of the MBO belongs to
+ *   the holders, see @queues_rx_mbo.
  * @tx_completion: completion handler for transmitted packets
+ * @queues_rx_mbo: the AIM queues received buffers by their list head. Only
+ *   one such AIM can be linked to a channel at a time.
  * @context: context pointer to be used by mostcore
  */
 struct most_aim {
@@ -314,6 +413,7 @@ struct most_aim {
 	void (*deliver_netinfo)(struct most_interface *iface,
 			        unsigned char link_stat,
 			        unsigned char *mac_addr);
+	bool queues_rx_mbo;
 	void *context;
 };
 
@@ -334,8 +434,10 @@ struct most_aim {
  *
  * The configuration for the channel is applied at the time of
  * registration of the parent most_interface.
+ *
+ * Returns 0 on success or -ENOMEM.
  */
-void most_register_config_set(struct most_config_set *cfg_set);
+int most_register_config_set(struct most_config_set *cfg_set);
 
 /**
  * most_deregister_config_set - deregisters the prior registered
@@ -364,6 +466,33 @@ struct kobject *most_register_interface(struct most_interface *iface);
  * @intf_instance Pointer to the interface instance description.
  */
 void most_deregister_interface(struct most_interface *iface);
+
+/**
+ * most_wait_for_links - waits until the channels of an interface have been
+ *     configured and linked by the configuration sets
+ * @iface: Pointer to the interface instance description.
+ *
+ * Only needed if the core links channels asynchronously (async_link).
+ */
+void most_wait_for_links(struct most_interface *iface);
+
+/**
+ * most_poll_schedule - asks the core to call the HDM's poll() in softirq
+ *     context
+ * @iface: Pointer to the interface instance description.
+ */
+void most_poll_schedule(struct most_interface *iface);
+
+/**
+ * most_complete_batch - completes a list of MBOs of one channel at once
+ * @iface: Pointer to the interface instance description.
+ * @channel_idx: channel index
+ * @done: list of completed MBOs, linked by their list member
+ *
+ * The AIMs of a Tx channel are notified once for the whole list.
+ */
+void most_complete_batch(struct most_interface *iface, int channel_idx,
+			 struct list_head *done);
 void most_submit_mbo(struct mbo *mbo);
 
 /**
@@ -382,6 +511,17 @@ void most_stop_enqueue(struct most_interface *iface, int channel_idx);
  * in wait fifo.
  */
 void most_resume_enqueue(struct most_interface *iface, int channel_idx);
+
+/**
+ * most_channel_event - reports an event of a channel to user space
+ * @iface: pointer to interface
+ * @channel_idx: channel index
+ * @ev: event
+ *
+ * May be called in atomic context.
+ */
+void most_channel_event(struct most_interface *iface, int channel_idx,
+			enum most_channel_event ev);
 int most_register_aim(struct most_aim *aim);
 int most_deregister_aim(struct most_aim *aim);
 struct mbo *most_get_mbo(struct most_interface *iface, int channel_idx,
@@ -393,6 +533,46 @@ int most_start_channel(struct most_interface *iface, int channel_idx,
 		       struct most_aim *);
 int most_stop_channel(struct most_interface *iface, int channel_idx,
 		      struct most_aim *);
+
+/**
+ * most_reconfigure_channel - applies a changed configuration to a running
+ *     channel
+ * @iface: pointer to interface
+ * @channel_idx: channel index
+ *
+ * Returns -EBUSY if a changed field cannot be changed while the channel is
+ * running.
+ */
+int most_reconfigure_channel(struct most_interface *iface, int channel_idx);
+
+/**
+ * most_stop_channel_async - stops a channel without waiting for its buffers
+ * @iface: pointer to interface
+ * @channel_idx: channel index
+ * @aim: AIM stopping the channel
+ * @done: optional callback, called when the channel has been stopped
+ * @priv: argument of done
+ *
+ * The channel is poisoned at once, while the buffers are collected from
+ * the HDM in a work item. done may be called from that work item or before
+ * this returns. A following most_start_channel() waits until the stop has
+ * finished.
+ */
+int most_stop_channel_async(struct most_interface *iface, int channel_idx,
+			    struct most_aim *aim,
+			    void (*done)(struct most_interface *iface,
+					 int channel_idx, void *priv),
+			    void *priv);
+
+/**
+ * most_sched_thread - applies the scheduling policy, priority and CPU
+ *     affinity configured for a channel to a thread serving it
+ * @iface: pointer to interface
+ * @channel_idx: channel index
+ * @task: thread of the AIM
+ */
+void most_sched_thread(struct most_interface *iface, int channel_idx,
+		       struct task_struct *task);
 void most_deliver_netinfo(struct most_interface *iface,
 			  unsigned char link_stat, unsigned char *mac_addr);
 